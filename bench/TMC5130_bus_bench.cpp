@@ -0,0 +1,218 @@
+/*
+ * TMC5130_bus_bench.cpp
+ *
+ *  Bus cost of every public Thorlabs_TMC5130 method, measured against the
+ *  simulated chip. Prints one CSV row per method, front end and configuration:
+ *
+ *    method,front,config,calls,datagrams,bytes,begins,ends,bus_ns,wall_ns
+ *
+ *  front is "virtual" for Thorlabs_TMC5130_sim and "static" for
+ *  Thorlabs_TMC5130_static over Thorlabs_TMC5130_sim_transport. The static
+ *  front end has no async calls, those rows are virtual only.
+ *
+ *  Counts and times are per call, averaged over the given number of calls.
+ *  bus_ns is simulated SPI time at 4MHz, wall_ns is host time including the model.
+ *
+ *  Build & run on a Linux host:
+ *    g++ -std=c++11 -O2 -Iinc bench/TMC5130_bus_bench.cpp src/TMC5130_*.cpp -o TMC5130_bus_bench
+ *    ./TMC5130_bus_bench [calls]
+ */
+
+#include "TMC5130_sim.h"
+#include "TMC5130_static.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef Thorlabs_TMC5130_sim::simStats simStats;
+
+//Thorlabs_TMC5130_sim_transport, counting the same way Thorlabs_TMC5130_sim does
+class benchTransport : public Thorlabs_TMC5130_sim_transport {
+public:
+
+	benchTransport() { memset(&stats, 0, sizeof(stats)); }
+
+	simStats stats;
+
+	inline void begin()
+	{
+		uint64_t start = bus->now();
+		stats.begins++;
+		Thorlabs_TMC5130_sim_transport::begin();
+		stats.bus_ns += bus->now() - start;
+	}
+
+	inline void end() { stats.ends++; }
+
+	inline void transfer(uint8_t *buf, size_t count)
+	{
+		uint64_t start = bus->now();
+		stats.transfers++;
+		stats.datagrams++;
+		stats.bytes += count;
+		Thorlabs_TMC5130_sim_transport::transfer(buf, count);
+		stats.bus_ns += bus->now() - start;
+	}
+
+};
+
+typedef Thorlabs_TMC5130_static<benchTransport> staticDriver;
+
+static void start(Thorlabs_TMC5130_sim& d) { d.begin(0); }
+static void start(staticDriver& d) { d.begin(); }
+
+static simStats getStats(Thorlabs_TMC5130_sim& d) { return d.getSimStats(); }
+static simStats getStats(staticDriver& d) { return d.transport.stats; }
+
+static void resetStats(Thorlabs_TMC5130_sim& d) { d.resetSimStats(); }
+static void resetStats(staticDriver& d) { memset(&d.transport.stats, 0, sizeof(d.transport.stats)); }
+
+typedef struct {
+	const char* name;
+	void (*func)(Thorlabs_TMC5130_sim& drv, uint32_t i);
+	void (*staticFunc)(staticDriver& drv, uint32_t i);	// NULL if the static front end has no equivalent
+} benchCase;
+
+#define BENCH_CASE(name, func) {name, func<Thorlabs_TMC5130_sim>, func<staticDriver>}
+
+typedef struct {
+	const char* name;
+	bool shadow;
+	bool suppress;
+} benchConfig;
+
+static int32_t sink;
+static Thorlabs_TMC5130::asyncTransfer xfer;
+
+template <class Driver> static void b_begin(Driver& d, uint32_t) { start(d); }
+template <class Driver> static void b_write_register(Driver& d, uint32_t i) { d.write_register(MCL_TPOWERDOWN, i & 0xFF); }
+template <class Driver> static void b_read_register(Driver& d, uint32_t) { d.read_register(MCL_XACTUAL, &sink); }
+template <class Driver> static void b_read_registers_3(Driver& d, uint32_t)
+{
+	const uint8_t addrs[3] = {MCL_XACTUAL, MCL_VACTUAL, MCL_X_ENC};
+	int32_t out[3];
+	d.read_registers(addrs, 3, out);
+}
+template <class Driver> static void b_write_registers_7(Driver& d, uint32_t i)
+{
+	const uint8_t addrs[7] = {MCL_A1, MCL_V1, MCL_AMAX, MCL_VMAX, MCL_DMAX, MCL_D1, MCL_VSTOP};
+	const uint32_t data[7] = {1000, 20000, 10000, 200000 + (i & 1), 15000, 50000, 10};
+	d.write_registers(addrs, data, 7);
+}
+template <class Driver> static void b_modify_register(Driver& d, uint32_t i) { d.modify_register(MCL_GCONF, 0x10, (i & 1) << 4); }
+template <class Driver> static void b_syncShadowRegisters(Driver& d, uint32_t) { d.syncShadowRegisters(); }
+template <class Driver> static void b_setRampMode(Driver& d, uint32_t) { d.setRampMode(Thorlabs_TMC5130::positionMode); }
+template <class Driver> static void b_jog(Driver& d, uint32_t) { d.jog(1); }
+template <class Driver> static void b_moveTo(Driver& d, uint32_t) { d.moveTo(1000); }
+template <class Driver> static void b_setVelocity(Driver& d, uint32_t) { d.setVelocity(200000); }
+template <class Driver> static void b_enableStealthChop(Driver& d, uint32_t i) { d.enableStealthChop(i & 1); }
+template <class Driver> static void b_reverseDirection(Driver& d, uint32_t i) { d.reverseDirection(i & 1); }
+template <class Driver> static void b_setPosition(Driver& d, uint32_t) { d.setPosition(0); }
+template <class Driver> static void b_getPosition(Driver& d, uint32_t) { sink = d.getPosition(); }
+template <class Driver> static void b_setCurrentLimits(Driver& d, uint32_t) { d.setCurrentLimits(0.5, 1.0); }
+template <class Driver> static void b_updateMotionProfile(Driver& d, uint32_t) { d.updateMotionProfile(); }
+template <class Driver> static void b_getEncoderPosition(Driver& d, uint32_t) { sink = d.getEncoderPosition(); }
+template <class Driver> static void b_setEncoderPosition(Driver& d, uint32_t) { d.setEncoderPosition(0); }
+template <class Driver> static void b_getVelocity(Driver& d, uint32_t) { sink = d.getVelocity(); }
+template <class Driver> static void b_isStopped(Driver& d, uint32_t) { sink = d.isStopped(); }
+template <class Driver> static void b_isStopped_cached(Driver& d, uint32_t) { sink = d.getPosition() + d.isStopped(true); }
+template <class Driver> static void b_isAtTarget(Driver& d, uint32_t) { sink = d.isAtTarget(); }
+template <class Driver> static void b_isAtTarget_cached(Driver& d, uint32_t) { sink = d.getPosition() + d.isAtTarget(true); }
+template <class Driver> static void b_getRampStatus(Driver& d, uint32_t) { sink = d.getRampStatus().vzero; }
+template <class Driver> static void b_clearRampEvents(Driver& d, uint32_t) { d.clearRampEvents(); }
+static void b_getPosition_async(Thorlabs_TMC5130_sim& d, uint32_t) { d.getPosition_async(&sink, &xfer); d.poll(); }
+static void b_moveTo_async(Thorlabs_TMC5130_sim& d, uint32_t) { d.moveTo_async(1000, &xfer); d.poll(); }
+
+static const benchCase cases[] = {
+	BENCH_CASE("begin", b_begin),
+	BENCH_CASE("write_register", b_write_register),
+	BENCH_CASE("read_register", b_read_register),
+	BENCH_CASE("read_registers(3)", b_read_registers_3),
+	BENCH_CASE("write_registers(7)", b_write_registers_7),
+	BENCH_CASE("modify_register", b_modify_register),
+	BENCH_CASE("syncShadowRegisters", b_syncShadowRegisters),
+	BENCH_CASE("setRampMode", b_setRampMode),
+	BENCH_CASE("jog", b_jog),
+	BENCH_CASE("moveTo", b_moveTo),
+	BENCH_CASE("setVelocity", b_setVelocity),
+	BENCH_CASE("enableStealthChop", b_enableStealthChop),
+	BENCH_CASE("reverseDirection", b_reverseDirection),
+	BENCH_CASE("setPosition", b_setPosition),
+	BENCH_CASE("getPosition", b_getPosition),
+	BENCH_CASE("setCurrentLimits", b_setCurrentLimits),
+	BENCH_CASE("updateMotionProfile", b_updateMotionProfile),
+	BENCH_CASE("getEncoderPosition", b_getEncoderPosition),
+	BENCH_CASE("setEncoderPosition", b_setEncoderPosition),
+	BENCH_CASE("getVelocity", b_getVelocity),
+	BENCH_CASE("isStopped", b_isStopped),
+	BENCH_CASE("getPosition+isStopped(cached)", b_isStopped_cached),
+	BENCH_CASE("isAtTarget", b_isAtTarget),
+	BENCH_CASE("getPosition+isAtTarget(cached)", b_isAtTarget_cached),
+	BENCH_CASE("getRampStatus", b_getRampStatus),
+	BENCH_CASE("clearRampEvents", b_clearRampEvents),
+	{"getPosition_async", b_getPosition_async, NULL},
+	{"moveTo_async", b_moveTo_async, NULL},
+};
+
+static const benchConfig configs[] = {
+	{"plain", false, false},
+	{"shadow", true, false},
+	{"suppress", true, true},
+};
+
+template <class Driver>
+static void runCase(const char* front, const benchConfig& config, const char* name,
+	void (*func)(Driver& drv, uint32_t i), uint32_t calls)
+{
+	Driver drv;
+	Thorlabs_TMC5130::shadowRegisters shadow;
+
+	//Fresh, initialized driver (begin() clears the reset flag)
+	drv.enableShadowRegisters(config.shadow ? &shadow : NULL);
+	drv.enableWriteSuppression(config.suppress);
+	start(drv);
+	if (config.shadow) {
+		drv.syncShadowRegisters();
+	}
+	resetStats(drv);
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < calls; i++) {
+		func(drv, i);
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	simStats stats = getStats(drv);
+	double wall = std::chrono::duration<double, std::nano>(end - begin).count();
+
+	printf("%s,%s,%s,%u,%.2f,%.2f,%.2f,%.2f,%.0f,%.1f\n",
+		name, front, config.name, calls,
+		(double)stats.datagrams / calls,
+		(double)stats.bytes / calls,
+		(double)stats.begins / calls,
+		(double)stats.ends / calls,
+		(double)stats.bus_ns / calls,
+		wall / calls);
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t calls = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000;
+	if (calls == 0) {
+		calls = 1;
+	}
+
+	printf("method,front,config,calls,datagrams,bytes,begins,ends,bus_ns,wall_ns\n");
+
+	for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		for (size_t m = 0; m < sizeof(cases) / sizeof(cases[0]); m++) {
+			runCase("virtual", configs[c], cases[m].name, cases[m].func, calls);
+			if (cases[m].staticFunc) {
+				runCase("static", configs[c], cases[m].name, cases[m].staticFunc, calls);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * TMC5130_codec_bench.cpp
+ *
+ *  Microbenchmarks for datagram packing: encode, decode, batch encode, sign
+ *  extension of 20/24/32 bit fields and decoding of the SPI_STATUS / RAMP_STAT
+ *  flags. Each operation is run with the library implementation
+ *  (Thorlabs_TMC5130_datagram, Thorlabs_TMC5130::decodeStatus() and
+ *  decodeRampStatus()) and alternatives (byte shifts, byte swap, table lookup,
+ *  SSSE3 shuffle), so they can be compared on the same box. Prints CSV:
+ *
+ *    benchmark,variant,ns_per_op,checksum
+ *
+ *  Variants of the same benchmark must report the same checksum.
+ *
+ *  Build & run on a Linux host (add -mssse3 or -march=native for the SIMD variant):
+ *    g++ -std=c++11 -O2 -Iinc bench/TMC5130_codec_bench.cpp src/TMC5130_lib.cpp src/TMC5130_core.cpp -o TMC5130_codec_bench
+ *    ./TMC5130_codec_bench [iterations]
+ */
+
+#include "TMC5130_datagram.h"
+#include "TMC5130_lib.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#define SET_SIZE        1024	// Inputs cycled through by each benchmark
+#define BATCH_SIZE      8		// Datagrams per batch encode
+
+static uint8_t addrs[SET_SIZE];
+static uint32_t words[SET_SIZE];
+static uint8_t frames[SET_SIZE * MCL_DATAGRAM_SIZE];
+
+//Keep the compiler from optimising a result away
+static inline void keep(const void* p)
+{
+#if defined(__GNUC__)
+	__asm__ __volatile__("" : : "r"(p) : "memory");
+#else
+	(void)p;
+#endif
+}
+
+
+//-----------------------------------------------------------------------
+//----------------------------- Encoders --------------------------------
+//-----------------------------------------------------------------------
+
+static inline void encode_library(uint8_t* cmd, uint8_t addr, uint32_t data)
+{
+	Thorlabs_TMC5130_datagram::encode(cmd, addr, data);
+}
+
+static inline void encode_shift(uint8_t* cmd, uint8_t addr, uint32_t data)
+{
+	cmd[0] = addr;
+	cmd[1] = (data >> 24) & 0xFF;
+	cmd[2] = (data >> 16) & 0xFF;
+	cmd[3] = (data >> 8) & 0xFF;
+	cmd[4] = data & 0xFF;
+}
+
+static inline void encode_bswap(uint8_t* cmd, uint8_t addr, uint32_t data)
+{
+	uint32_t be = __builtin_bswap32(data);
+	cmd[0] = addr;
+	memcpy(&cmd[1], &be, 4);
+}
+
+static inline int32_t decode_library(const uint8_t* cmd)
+{
+	return Thorlabs_TMC5130_datagram::decode(cmd);
+}
+
+static inline int32_t decode_bswap(const uint8_t* cmd)
+{
+	uint32_t be;
+	memcpy(&be, &cmd[1], 4);
+	return (int32_t)__builtin_bswap32(be);
+}
+
+static void batch_library(uint8_t* out, const uint8_t* a, const uint32_t* d, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		encode_library(&out[i * MCL_DATAGRAM_SIZE], a[i], d[i]);
+	}
+}
+
+static void batch_shift(uint8_t* out, const uint8_t* a, const uint32_t* d, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		encode_shift(&out[i * MCL_DATAGRAM_SIZE], a[i], d[i]);
+	}
+}
+
+static void batch_bswap(uint8_t* out, const uint8_t* a, const uint32_t* d, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		encode_bswap(&out[i * MCL_DATAGRAM_SIZE], a[i], d[i]);
+	}
+}
+
+#if defined(__SSSE3__)
+//Four datagrams per step: one shuffle places the byte-swapped data, a second the
+//address bytes, the 4 bytes past the 16 byte vector are finished in scalar code
+static void batch_ssse3(uint8_t* out, const uint8_t* a, const uint32_t* d, size_t n)
+{
+	const __m128i dataMask = _mm_setr_epi8(-1, 3, 2, 1, 0, -1, 7, 6, 5, 4, -1, 11, 10, 9, 8, -1);
+	const __m128i addrMask = _mm_setr_epi8(0, -1, -1, -1, -1, 1, -1, -1, -1, -1, 2, -1, -1, -1, -1, 3);
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		uint32_t a4;
+		memcpy(&a4, &a[i], 4);
+
+		__m128i data = _mm_loadu_si128((const __m128i*)&d[i]);
+		__m128i packed = _mm_or_si128(_mm_shuffle_epi8(data, dataMask),
+			_mm_shuffle_epi8(_mm_cvtsi32_si128(a4), addrMask));
+
+		_mm_storeu_si128((__m128i*)&out[i * MCL_DATAGRAM_SIZE], packed);
+
+		uint32_t last = __builtin_bswap32(d[i + 3]);
+		memcpy(&out[i * MCL_DATAGRAM_SIZE + 16], &last, 4);
+	}
+	for (; i < n; i++) {
+		encode_bswap(&out[i * MCL_DATAGRAM_SIZE], a[i], d[i]);
+	}
+}
+#endif
+
+
+//-----------------------------------------------------------------------
+//--------------------------- Sign extension ----------------------------
+//-----------------------------------------------------------------------
+
+static inline int32_t sext_shift(uint32_t v, uint8_t bits)
+{
+	return Thorlabs_TMC5130_datagram::signExtend(v, bits);
+}
+
+static inline int32_t sext_xor(uint32_t v, uint8_t bits)
+{
+	uint32_t m = 1UL << (bits - 1);
+	uint32_t field = (bits == 32) ? v : (v & ((1UL << bits) - 1));
+	return (int32_t)((field ^ m) - m);
+}
+
+static const uint32_t signTable[33] = {
+	0, 0xFFFFFFFF, 0xFFFFFFFE, 0xFFFFFFFC, 0xFFFFFFF8, 0xFFFFFFF0, 0xFFFFFFE0, 0xFFFFFFC0,
+	0xFFFFFF80, 0xFFFFFF00, 0xFFFFFE00, 0xFFFFFC00, 0xFFFFF800, 0xFFFFF000, 0xFFFFE000, 0xFFFFC000,
+	0xFFFF8000, 0xFFFF0000, 0xFFFE0000, 0xFFFC0000, 0xFFF80000, 0xFFF00000, 0xFFE00000, 0xFFC00000,
+	0xFF800000, 0xFF000000, 0xFE000000, 0xFC000000, 0xF8000000, 0xF0000000, 0xE0000000, 0xC0000000,
+	0x80000000
+};
+
+static inline int32_t sext_table(uint32_t v, uint8_t bits)
+{
+	uint32_t upper = signTable[bits];
+	return (int32_t)((v & (1UL << (bits - 1))) ? (v | upper) : (v & ~upper));
+}
+
+
+//-----------------------------------------------------------------------
+//--------------------------- Status decoding ---------------------------
+//-----------------------------------------------------------------------
+
+typedef Thorlabs_TMC5130::spiStatus spiStatus;
+typedef Thorlabs_TMC5130::rampStatus rampStatus;
+
+static inline spiStatus status_library(uint8_t status)
+{
+	return Thorlabs_TMC5130::decodeStatus(status);
+}
+
+//Every SPI_STATUS byte decoded up front, filled in main()
+static spiStatus statusTable[256];
+
+static inline spiStatus status_table(uint8_t status)
+{
+	return statusTable[status];
+}
+
+static inline rampStatus ramp_library(uint32_t status)
+{
+	return Thorlabs_TMC5130::decodeRampStatus(status);
+}
+
+//Shift each flag down in register order instead of testing masks
+static inline rampStatus ramp_shift(uint32_t status)
+{
+	rampStatus decoded;
+	decoded.status_stop_l = status & 1;
+	decoded.status_stop_r = (status >> 1) & 1;
+	decoded.status_latch_l = (status >> 2) & 1;
+	decoded.status_latch_r = (status >> 3) & 1;
+	decoded.event_stop_l = (status >> 4) & 1;
+	decoded.event_stop_r = (status >> 5) & 1;
+	decoded.event_stop_sg = (status >> 6) & 1;
+	decoded.event_pos_reached = (status >> 7) & 1;
+	decoded.velocity_reached = (status >> 8) & 1;
+	decoded.position_reached = (status >> 9) & 1;
+	decoded.vzero = (status >> 10) & 1;
+	decoded.t_zerowait_active = (status >> 11) & 1;
+	decoded.second_move = (status >> 12) & 1;
+	decoded.status_sg = (status >> 13) & 1;
+	return decoded;
+}
+
+//Fold decoded flags back into bits for the checksum
+static inline uint32_t pack(const spiStatus& d)
+{
+	return d.reset_flag | (d.driver_error << 1) | (d.stallGuard << 2) | (d.standstill << 3)
+		| (d.velocity_reached << 4) | (d.position_reached << 5) | (d.stop_l << 6) | (d.stop_r << 7);
+}
+
+static inline uint32_t pack(const rampStatus& d)
+{
+	return d.status_stop_l | (d.status_stop_r << 1) | (d.status_latch_l << 2) | (d.status_latch_r << 3)
+		| (d.event_stop_l << 4) | (d.event_stop_r << 5) | (d.event_stop_sg << 6) | (d.event_pos_reached << 7)
+		| (d.velocity_reached << 8) | (d.position_reached << 9) | (d.vzero << 10)
+		| (d.t_zerowait_active << 11) | (d.second_move << 12) | (d.status_sg << 13);
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------------ Harness --------------------------------
+//-----------------------------------------------------------------------
+
+static void report(const char* bench, const char* variant, double ns, uint64_t ops, uint32_t checksum)
+{
+	printf("%s,%s,%.3f,%08x\n", bench, variant, ns / ops, checksum);
+}
+
+typedef std::chrono::steady_clock benchClock;
+
+static double elapsed_ns(benchClock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(benchClock::now() - start).count();
+}
+
+template <void (*Encode)(uint8_t*, uint8_t, uint32_t)>
+static void bench_encode(const char* variant, uint32_t iterations)
+{
+	uint32_t checksum = 0;
+	benchClock::time_point start = benchClock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		for (size_t i = 0; i < SET_SIZE; i++) {
+			Encode(&frames[i * MCL_DATAGRAM_SIZE], addrs[i], words[i] + it);
+		}
+		keep(frames);
+		checksum = checksum * 31 + frames[(it % SET_SIZE) * MCL_DATAGRAM_SIZE + 4];
+	}
+	report("encode", variant, elapsed_ns(start), (uint64_t)iterations * SET_SIZE, checksum);
+}
+
+template <int32_t (*Decode)(const uint8_t*)>
+static void bench_decode(const char* variant, uint32_t iterations)
+{
+	uint32_t checksum = 0;
+	benchClock::time_point start = benchClock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		uint32_t sum = 0;
+		keep(frames);
+		for (size_t i = 0; i < SET_SIZE; i++) {
+			sum += (uint32_t)Decode(&frames[i * MCL_DATAGRAM_SIZE]);
+		}
+		checksum = checksum * 31 + sum;
+	}
+	report("decode", variant, elapsed_ns(start), (uint64_t)iterations * SET_SIZE, checksum);
+}
+
+template <void (*Batch)(uint8_t*, const uint8_t*, const uint32_t*, size_t)>
+static void bench_batch(const char* variant, uint32_t iterations)
+{
+	uint32_t checksum = 0;
+	benchClock::time_point start = benchClock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		for (size_t i = 0; i + BATCH_SIZE <= SET_SIZE; i += BATCH_SIZE) {
+			Batch(&frames[i * MCL_DATAGRAM_SIZE], &addrs[i], &words[i], BATCH_SIZE);
+		}
+		keep(frames);
+		for (size_t i = 0; i < BATCH_SIZE * MCL_DATAGRAM_SIZE; i++) {
+			checksum = checksum * 31 + frames[(it % (SET_SIZE / BATCH_SIZE)) * BATCH_SIZE * MCL_DATAGRAM_SIZE + i];
+		}
+	}
+	report("batch_encode_8", variant, elapsed_ns(start), (uint64_t)iterations * SET_SIZE, checksum);
+}
+
+template <int32_t (*Sext)(uint32_t, uint8_t)>
+static void bench_sext(const char* bench, const char* variant, uint8_t bits, uint32_t iterations)
+{
+	uint32_t checksum = 0;
+	benchClock::time_point start = benchClock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		uint32_t sum = 0;
+		keep(words);
+		for (size_t i = 0; i < SET_SIZE; i++) {
+			sum += (uint32_t)Sext(words[i] & ((bits == 32) ? 0xFFFFFFFF : ((1UL << bits) - 1)), bits);
+		}
+		checksum = checksum * 31 + sum;
+	}
+	report(bench, variant, elapsed_ns(start), (uint64_t)iterations * SET_SIZE, checksum);
+}
+
+template <spiStatus (*Decode)(uint8_t)>
+static void bench_status(const char* variant, uint32_t iterations)
+{
+	uint32_t checksum = 0;
+	benchClock::time_point start = benchClock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		uint32_t sum = 0;
+		keep(words);
+		for (size_t i = 0; i < SET_SIZE; i++) {
+			sum += pack(Decode((uint8_t)words[i]));
+		}
+		checksum = checksum * 31 + sum;
+	}
+	report("decode_status", variant, elapsed_ns(start), (uint64_t)iterations * SET_SIZE, checksum);
+}
+
+template <rampStatus (*Decode)(uint32_t)>
+static void bench_ramp(const char* variant, uint32_t iterations)
+{
+	uint32_t checksum = 0;
+	benchClock::time_point start = benchClock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		uint32_t sum = 0;
+		keep(words);
+		for (size_t i = 0; i < SET_SIZE; i++) {
+			sum += pack(Decode(words[i] & 0x3FFF));
+		}
+		checksum = checksum * 31 + sum;
+	}
+	report("decode_ramp_status", variant, elapsed_ns(start), (uint64_t)iterations * SET_SIZE, checksum);
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20000;
+
+	//Fixed pseudo-random inputs so every run, and every variant, sees the same data
+	uint32_t seed = 0x5130;
+	for (size_t i = 0; i < SET_SIZE; i++) {
+		seed = seed * 1664525 + 1013904223;
+		words[i] = seed;
+		addrs[i] = (seed >> 24) | MCL_WRITE_BIT;
+	}
+	for (size_t i = 0; i < 256; i++) {
+		statusTable[i] = Thorlabs_TMC5130::decodeStatus(i);
+	}
+
+	printf("benchmark,variant,ns_per_op,checksum\n");
+
+	bench_encode<encode_library>("library", iterations);
+	bench_encode<encode_shift>("shift", iterations);
+	bench_encode<encode_bswap>("bswap", iterations);
+
+	bench_decode<decode_library>("library", iterations);
+	bench_decode<decode_bswap>("bswap", iterations);
+
+	bench_batch<batch_library>("library", iterations);
+	bench_batch<batch_shift>("shift", iterations);
+	bench_batch<batch_bswap>("bswap", iterations);
+#if defined(__SSSE3__)
+	bench_batch<batch_ssse3>("ssse3", iterations);
+#endif
+
+	bench_sext<sext_shift>("sign_extend_20", "shift", 20, iterations);
+	bench_sext<sext_xor>("sign_extend_20", "xor", 20, iterations);
+	bench_sext<sext_table>("sign_extend_20", "table", 20, iterations);
+	bench_sext<sext_shift>("sign_extend_24", "shift", 24, iterations);
+	bench_sext<sext_xor>("sign_extend_24", "xor", 24, iterations);
+	bench_sext<sext_table>("sign_extend_24", "table", 24, iterations);
+	bench_sext<sext_shift>("sign_extend_32", "shift", 32, iterations);
+	bench_sext<sext_xor>("sign_extend_32", "xor", 32, iterations);
+	bench_sext<sext_table>("sign_extend_32", "table", 32, iterations);
+
+	bench_status<status_library>("library", iterations);
+	bench_status<status_table>("table", iterations);
+
+	bench_ramp<ramp_library>("library", iterations);
+	bench_ramp<ramp_shift>("shift", iterations);
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * TMC5130_motion_bench.cpp
+ *
+ *  Thorlabs_TMC5130_motion::estimate() against the simulated chip. Each move
+ *  is run on Thorlabs_TMC5130_sim from rest to rest, the time the model spends
+ *  in each ramp phase is compared with the estimate. Prints CSV:
+ *
+ *    profile,distance,phase,sim_ms,estimate_ms,error_us
+ *
+ *  One row per phase plus a "total" row per move. The last row is the largest
+ *  error seen over all phases ("max"). The model integrates in step_ns
+ *  (10 us by default) steps, so errors of a few steps are expected.
+ *
+ *  Build & run on a Linux host:
+ *    g++ -std=c++11 -O2 -Iinc bench/TMC5130_motion_bench.cpp src/TMC5130_*.cpp -o TMC5130_motion_bench
+ *    ./TMC5130_motion_bench
+ */
+
+#include "TMC5130_sim.h"
+#include "TMC5130_motion.h"
+#include <cmath>
+#include <cstdio>
+
+typedef Thorlabs_TMC5130_model model;
+
+typedef struct {
+	const char* name;
+	Thorlabs_TMC5130_motion::profile p;		// VSTART, A1, V1, AMAX, VMAX, DMAX, D1, VSTOP
+} benchProfile;
+
+static const benchProfile profiles[] = {
+	{"default", {0, 1000, 0x1000, 10000, 200000, 15000, 5000, 10}},
+	{"no_v1", {0, 1000, 0, 10000, 200000, 15000, 5000, 10}},
+	{"slow_d1", {0, 1000, 20000, 10000, 200000, 15000, 1000, 10}},
+	{"fast", {0, 2000, 5000, 30000, 1000000, 30000, 500, 10}},
+	{"vstart_vstop", {500, 1000, 0x1000, 10000, 200000, 15000, 5000, 1000}},
+};
+
+static const int32_t distances[] = {50, 500, 5000, 20000, 256000, 1000000};
+
+//Time spent in each model phase, filled by the phase callback
+static double phaseTime[16];
+static int lastPhase;
+static uint64_t lastTime;
+
+static void onPhase(void*, model::rampPhase phase, uint64_t time_ns)
+{
+	if (lastPhase >= 0) {
+		phaseTime[lastPhase] += (time_ns - lastTime) * 1e-9;
+	}
+	lastPhase = phase;
+	lastTime = time_ns;
+}
+
+static double maxError;
+
+static void row(const char* profile, int32_t distance, const char* phase, double sim, double estimate)
+{
+	double error = (sim - estimate) * 1e6;
+	printf("%s,%d,%s,%.4f,%.4f,%.1f\n", profile, (int)distance, phase, sim * 1e3, estimate * 1e3, error);
+	if (fabs(error) > maxError) {
+		maxError = fabs(error);
+	}
+}
+
+int main()
+{
+	printf("profile,distance,phase,sim_ms,estimate_ms,error_us\n");
+
+	for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+		for (size_t m = 0; m < sizeof(distances) / sizeof(distances[0]); m++) {
+			const Thorlabs_TMC5130_motion::profile& r = profiles[p].p;
+			Thorlabs_TMC5130_sim drv;
+
+			drv.begin(0);
+			drv.write_register(MCL_VSTART, r.VSTART);
+			drv.A1 = r.A1;
+			drv.V1 = r.V1;
+			drv.AMAX = r.AMAX;
+			drv.VMAX = r.VMAX;
+			drv.DMAX = r.DMAX;
+			drv.D1 = r.D1;
+			drv.VSTOP = r.VSTOP;
+			drv.updateMotionProfile();
+
+			for (size_t i = 0; i < sizeof(phaseTime) / sizeof(phaseTime[0]); i++) {
+				phaseTime[i] = 0;
+			}
+			lastPhase = -1;
+			drv.model.setPhaseCallback(onPhase, NULL);
+
+			//Run at the model's own step, from the moveTo() until it is at rest again
+			uint64_t start = drv.now();
+			drv.moveTo(distances[m]);
+			do {
+				drv.advance(drv.model.step_ns);
+			} while (drv.model.phase() != model::phaseStopped && drv.model.phase() != model::phaseZeroWait);
+			double total = (drv.now() - start) * 1e-9;
+
+			Thorlabs_TMC5130_motion::moveTime e = Thorlabs_TMC5130_motion::estimate(r, 0, distances[m]);
+
+			row(profiles[p].name, distances[m], "A1", phaseTime[model::phaseA1], e.a1);
+			row(profiles[p].name, distances[m], "AMAX", phaseTime[model::phaseAMAX], e.amax);
+			row(profiles[p].name, distances[m], "cruise", phaseTime[model::phaseCruise], e.cruise);
+			row(profiles[p].name, distances[m], "DMAX", phaseTime[model::phaseDMAX], e.dmax);
+			row(profiles[p].name, distances[m], "D1", phaseTime[model::phaseD1], e.d1);
+			row(profiles[p].name, distances[m], "total", total, e.total);
+		}
+	}
+
+	printf("max,,,,,%.1f\n", maxError);
+	return 0;
+}
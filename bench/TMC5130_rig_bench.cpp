@@ -0,0 +1,166 @@
+/*
+ * TMC5130_rig_bench.cpp
+ *
+ *  Scaling benchmark: a virtual rig of many simulated Thorlabs_TMC5130 axes
+ *  spread over several simulated SPI buses, run as a fixed period control loop.
+ *  Every cycle each axis has its position read (status comes with it), and axes
+ *  that reached their target get a new one, like a pick & place or scanning
+ *  rig would. Buses run in parallel, axes on one bus serialize.
+ *
+ *  Prints one CSV row per rig size:
+ *
+ *    axes,buses,cycles,period_us,moves,status_reads,moves_per_s,status_reads_per_s,
+ *    host_ns_per_axis,host_p50_ns,host_p99_ns,host_max_ns,bus_p50_ns,bus_p99_ns,bus_max_ns,overruns
+ *
+ *  moves_per_s and status_reads_per_s are in simulated time. host_* is the wall
+ *  time the library and model take per cycle (p50/p99/max over cycles), i.e.
+ *  where per-instance overhead stops scaling. bus_* is the busiest bus's
+ *  occupancy per cycle, overruns counts cycles where it didn't fit the period.
+ *
+ *  The models integrate their ramps in 100us steps (RIG_STEP_NS) rather than the
+ *  default 10us, so host time is dominated by the library, not the ramp maths.
+ *
+ *  Build & run on a Linux host (finer histogram buckets for the jitter columns):
+ *    g++ -std=c++11 -O2 -Iinc -DMCL_LATENCY_BITS=6 bench/TMC5130_rig_bench.cpp src/TMC5130_*.cpp -o TMC5130_rig_bench
+ *    ./TMC5130_rig_bench                            (sweep 100..4000 axes, 25 per bus)
+ *    ./TMC5130_rig_bench axes buses [cycles] [period_us]
+ */
+
+#include "TMC5130_sim.h"
+#include "TMC5130_histogram.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define RIG_STEP_NS     100000	// Ramp integration step of every model
+#define RIG_AXES_PER_BUS 25		// Sweep density, 25 x 20.2us position reads fit a 1ms cycle at 4MHz
+
+typedef std::chrono::steady_clock benchClock;
+
+typedef struct {
+	uint32_t axes;
+	uint32_t buses;
+	uint32_t cycles;
+	uint32_t period_us;
+} rigConfig;
+
+//Fixed pseudo-random targets so runs are repeatable
+static uint32_t seed = 0x5130;
+static int32_t nextTarget()
+{
+	seed = seed * 1664525 + 1013904223;
+	return (int32_t)((seed >> 8) % 40001) - 20000;
+}
+
+static void run(const rigConfig& cfg)
+{
+	std::vector<Thorlabs_TMC5130_simbus> buses(cfg.buses);
+	std::vector<Thorlabs_TMC5130_sim*> axes(cfg.axes);
+	std::vector<uint64_t> busStart(cfg.buses);
+
+	//Axes are dealt round robin, so bus b holds axes b, b + buses, ...
+	for (uint32_t i = 0; i < cfg.axes; i++) {
+		axes[i] = new Thorlabs_TMC5130_sim(&buses[i % cfg.buses]);
+		axes[i]->model.step_ns = RIG_STEP_NS;
+		axes[i]->begin(0);
+		axes[i]->setRampMode(Thorlabs_TMC5130::positionMode);
+		axes[i]->moveTo(nextTarget());
+	}
+
+	Thorlabs_TMC5130_histogram hostHist;
+	Thorlabs_TMC5130_histogram busHist;
+	uint64_t period_ns = (uint64_t)cfg.period_us * 1000;
+	uint64_t moves = 0;
+	uint64_t statusReads = 0;
+	uint64_t host_ns = 0;
+	uint32_t overruns = 0;
+
+	//Start every bus at the same point in time
+	uint64_t cycleStart = 0;
+	for (uint32_t b = 0; b < cfg.buses; b++) {
+		if (buses[b].now() > cycleStart) {
+			cycleStart = buses[b].now();
+		}
+	}
+
+	for (uint32_t c = 0; c < cfg.cycles; c++) {
+		for (uint32_t b = 0; b < cfg.buses; b++) {
+			if (buses[b].now() < cycleStart) {
+				buses[b].idle(cycleStart - buses[b].now());
+			}
+			busStart[b] = buses[b].now();
+		}
+
+		benchClock::time_point start = benchClock::now();
+		for (uint32_t i = 0; i < cfg.axes; i++) {
+			Thorlabs_TMC5130_sim* axis = axes[i];
+			axis->getPosition();
+			statusReads++;
+
+			if (axis->isAtTarget(true)) {
+				axis->moveTo(nextTarget());
+				moves++;
+			}
+		}
+		uint32_t wall = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(benchClock::now() - start).count();
+		hostHist.record(wall);
+		host_ns += wall;
+
+		//The cycle is as long as its busiest bus
+		uint64_t busiest = 0;
+		for (uint32_t b = 0; b < cfg.buses; b++) {
+			uint64_t used = buses[b].now() - busStart[b];
+			if (used > busiest) {
+				busiest = used;
+			}
+		}
+		busHist.record((uint32_t)busiest);
+		if (busiest > period_ns) {
+			overruns++;
+		}
+		cycleStart += (busiest > period_ns) ? busiest : period_ns;
+	}
+
+	double sim_s = (double)cfg.cycles * cfg.period_us / 1e6;
+	printf("%u,%u,%u,%u,%llu,%llu,%.0f,%.0f,%.1f,%u,%u,%u,%u,%u,%u,%u\n",
+		cfg.axes, cfg.buses, cfg.cycles, cfg.period_us,
+		(unsigned long long)moves, (unsigned long long)statusReads,
+		moves / sim_s, statusReads / sim_s,
+		(double)host_ns / cfg.cycles / cfg.axes,
+		hostHist.percentile(0.5), hostHist.percentile(0.99), hostHist.max(),
+		busHist.percentile(0.5), busHist.percentile(0.99), busHist.max(),
+		overruns);
+
+	for (uint32_t i = 0; i < cfg.axes; i++) {
+		delete axes[i];
+	}
+}
+
+int main(int argc, char** argv)
+{
+	printf("axes,buses,cycles,period_us,moves,status_reads,moves_per_s,status_reads_per_s,"
+		"host_ns_per_axis,host_p50_ns,host_p99_ns,host_max_ns,bus_p50_ns,bus_p99_ns,bus_max_ns,overruns\n");
+
+	if (argc >= 3) {
+		rigConfig cfg;
+		cfg.axes = strtoul(argv[1], NULL, 0);
+		cfg.buses = strtoul(argv[2], NULL, 0);
+		cfg.cycles = (argc > 3) ? strtoul(argv[3], NULL, 0) : 1000;
+		cfg.period_us = (argc > 4) ? strtoul(argv[4], NULL, 0) : 1000;
+		if (cfg.axes == 0 || cfg.buses == 0 || cfg.period_us == 0) {
+			fprintf(stderr, "axes, buses and period must be > 0\n");
+			return 2;
+		}
+		run(cfg);
+		return 0;
+	}
+
+	//Sweep at a fixed bus density, 1ms cycle
+	const uint32_t sizes[] = {100, 400, 1000, 2000, 4000};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		rigConfig cfg = {sizes[i], sizes[i] / RIG_AXES_PER_BUS, 1000, 1000};
+		run(cfg);
+	}
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * TMC5130_spidev_bench.cpp
+ *
+ *  Checks the spidev backend's ioctls without SPI hardware. The device is /dev/null,
+ *  every ioctl is caught in spidev_ioctl() and each SPI_IOC_MESSAGE is checked for
+ *  its request encoding (SPI_MSGSIZE(n)) and transfer layout (one 5 byte transfer
+ *  per datagram, rx == tx, cs_change on all but the last), then answered by the
+ *  simulated chip. Prints one CSV row per operation:
+ *
+ *    operation,calls,ioctls,transfers,max_transfers,cs_changes,errors
+ *
+ *  ioctls and transfers are totals over all calls. Exits with 1 if any check failed.
+ *
+ *  Build & run on a Linux host:
+ *    g++ -std=c++11 -O2 -Iinc bench/TMC5130_spidev_bench.cpp src/TMC5130_*.cpp -o TMC5130_spidev_bench
+ *    ./TMC5130_spidev_bench [calls]
+ */
+
+#include "TMC5130_spidev.h"
+#include "TMC5130_sim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+class benchSpidev : public Thorlabs_TMC5130_spidev {
+public:
+
+	Thorlabs_TMC5130_model model;
+
+	uint32_t transfers;
+	uint32_t maxTransfers;
+	uint32_t csChanges;
+	uint32_t errors;
+
+	benchSpidev() : Thorlabs_TMC5130_spidev("/dev/null") { clear(); }
+
+	void clear() { transfers = 0; maxTransfers = 0; csChanges = 0; errors = 0; _ioctls = 0; }
+
+protected:
+
+	void error(const char* what)
+	{
+		if (errors == 0) {
+			fprintf(stderr, "layout error: %s\n", what);
+		}
+		errors++;
+	}
+
+	virtual int spidev_ioctl(unsigned long request, void* arg)
+	{
+		if (request == SPI_IOC_WR_MODE) {
+			return *(uint8_t*)arg == SPI_MODE_3 ? 0 : (error("mode"), -1);
+		}
+		if (request == SPI_IOC_WR_BITS_PER_WORD) {
+			return *(uint8_t*)arg == 8 ? 0 : (error("bits"), -1);
+		}
+		if (request == SPI_IOC_WR_MAX_SPEED_HZ) {
+			return *(uint32_t*)arg == _speed ? 0 : (error("speed"), -1);
+		}
+
+		if (_IOC_TYPE(request) != SPI_IOC_MAGIC || _IOC_NR(request) != 0 || _IOC_DIR(request) != _IOC_WRITE) {
+			error("unknown request");
+			errno = ENOTTY;
+			return -1;
+		}
+
+		//The request carries the array size, it has to be a whole number of transfers
+		size_t size = _IOC_SIZE(request);
+		size_t n = size / sizeof(struct spi_ioc_transfer);
+		if (n == 0 || size != n * sizeof(struct spi_ioc_transfer)) {
+			error("message size");
+			errno = EINVAL;
+			return -1;
+		}
+		if (n <= 16 && request != (unsigned long)SPI_IOC_MESSAGE(n)) {
+			error("request differs from SPI_IOC_MESSAGE(n)");
+		}
+
+		struct spi_ioc_transfer* xfers = (struct spi_ioc_transfer*)arg;
+		int total = 0;
+		for (size_t i = 0; i < n; i++) {
+			uint8_t* buf = (uint8_t*)(uintptr_t)xfers[i].tx_buf;
+
+			if (xfers[i].rx_buf != xfers[i].tx_buf) error("rx_buf != tx_buf");
+			if (xfers[i].len != MCL_DATAGRAM_SIZE && n > 1) error("len");
+			if (xfers[i].speed_hz != _speed) error("speed_hz");
+			if (xfers[i].bits_per_word != 8) error("bits_per_word");
+			if (i > 0 && xfers[i].tx_buf != xfers[i - 1].tx_buf + MCL_DATAGRAM_SIZE) error("not contiguous");
+			if (xfers[i].cs_change != (i < n - 1 ? 1 : 0)) error("cs_change");
+
+			csChanges += xfers[i].cs_change;
+			if (xfers[i].len == MCL_DATAGRAM_SIZE) {
+				model.datagram(buf);
+			}
+			total += xfers[i].len;
+		}
+
+		transfers += n;
+		if (n > maxTransfers) {
+			maxTransfers = n;
+		}
+		return total;
+	}
+
+};
+
+static int32_t out[MCL_MAX_BATCH * 2];
+static uint8_t addrs[MCL_MAX_BATCH * 2];
+static uint32_t data[MCL_MAX_BATCH * 2];
+
+static void o_begin(benchSpidev& d, uint32_t) { d.begin(0); }
+static void o_write_register(benchSpidev& d, uint32_t i) { d.write_register(MCL_TPOWERDOWN, i & 0xFF); }
+static void o_read_register(benchSpidev& d, uint32_t) { d.read_register(MCL_XACTUAL, out); }
+static void o_updateMotionProfile(benchSpidev& d, uint32_t i) { d.AMAX = 1000 + (i & 0xFF); d.updateMotionProfile(); }
+
+//Reads chain one datagram late, n reads are n+1 transfers
+static void o_read_registers_4(benchSpidev& d, uint32_t)
+{
+	const uint8_t a[4] = { MCL_XACTUAL, MCL_VACTUAL, MCL_XTARGET, MCL_RAMP_STAT };
+	d.read_registers(a, 4, out);
+}
+
+//More than MCL_MAX_BATCH datagrams, split over several ioctls
+static void o_write_registers_max(benchSpidev& d, uint32_t i)
+{
+	for (size_t k = 0; k < MCL_MAX_BATCH * 2; k++) {
+		addrs[k] = MCL_TPOWERDOWN;
+		data[k] = (i + k) & 0xFF;
+	}
+	d.write_registers(addrs, data, MCL_MAX_BATCH * 2);
+}
+
+static void o_transfer_registers(benchSpidev& d, uint32_t i)
+{
+	const uint8_t a[3] = { MCL_XACTUAL, MCL_VACTUAL, MCL_TPOWERDOWN | 0x80 };
+	const uint32_t v[3] = { 0, 0, i & 0xFF };
+	d.transfer_registers(a, v, 3, out);
+}
+
+typedef struct {
+	const char* name;
+	void (*func)(benchSpidev& d, uint32_t i);
+} benchCase;
+
+static const benchCase cases[] = {
+	{ "begin", o_begin },
+	{ "write_register", o_write_register },
+	{ "read_register", o_read_register },
+	{ "read_registers_4", o_read_registers_4 },
+	{ "write_registers_2x_batch", o_write_registers_max },
+	{ "transfer_registers", o_transfer_registers },
+	{ "updateMotionProfile", o_updateMotionProfile },
+};
+
+int main(int argc, char** argv)
+{
+	uint32_t calls = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+	benchSpidev d;
+	bool fail = false;
+
+	d.begin(0);
+	if (!d.isOpen()) {
+		fprintf(stderr, "could not open /dev/null: %s\n", strerror(d.lastError()));
+		return 1;
+	}
+
+	printf("operation,calls,ioctls,transfers,max_transfers,cs_changes,errors\n");
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		d.clear();
+		for (uint32_t i = 0; i < calls; i++) {
+			cases[c].func(d, i);
+		}
+		printf("%s,%u,%u,%u,%u,%u,%u\n", cases[c].name, calls, d.getIoctlCount(),
+			d.transfers, d.maxTransfers, d.csChanges, d.errors);
+		if (d.errors || d.maxTransfers > MCL_MAX_BATCH) {
+			fail = true;
+		}
+	}
+
+	//The replies came from the model, so what was written must read back
+	int32_t v = 0;
+	d.write_register(MCL_XTARGET, 12345);
+	d.read_register(MCL_XTARGET, &v);
+	if (v != 12345) {
+		fprintf(stderr, "readback: XTARGET %d, expected 12345\n", (int)v);
+		fail = true;
+	}
+
+	return fail ? 1 : 0;
+}
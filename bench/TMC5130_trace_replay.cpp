@@ -0,0 +1,439 @@
+/*
+ * TMC5130_trace_replay.cpp
+ *
+ *  Replays SPI traces dumped by Thorlabs_TMC5130_trace against the chip model
+ *  and compares two of them, i.e. the same production workload captured with
+ *  two library versions.
+ *
+ *  Every recorded batch is sent to a Thorlabs_TMC5130_model (one per driver id)
+ *  on a simulated bus, keeping the recorded gaps between batches, so the ramp
+ *  generator sees the same timing. For each trace this reports datagrams,
+ *  batches, bus time, replies that differ from the model and per-register
+ *  traffic. Given a second trace, it lines both up per register and per
+ *  operation (the registers touched by one batch) and flags where the
+ *  candidate issues more datagrams than the baseline.
+ *
+ *  Build & run on a Linux host (the trace switch and depth only matter for --record):
+ *    g++ -std=c++11 -O2 -Iinc -DMCL_ENABLE_TRACE -DMCL_TRACE_DEPTH=4096 bench/TMC5130_trace_replay.cpp src/TMC5130_*.cpp -o TMC5130_trace_replay
+ *    ./TMC5130_trace_replay baseline.bin [candidate.bin]
+ *    ./TMC5130_trace_replay --record out.bin
+ *
+ *  --record runs a fixed move/poll workload on the simulator with this build of
+ *  the library and dumps its trace, so two library versions can be compared
+ *  without hardware.
+ */
+
+#include "TMC5130_sim.h"
+#include "TMC5130_trace.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#define REPLAY_SPI_HZ   4000000
+#define REPLAY_IDS      256
+
+typedef Thorlabs_TMC5130_trace::record traceRecord;
+
+typedef struct {
+	uint32_t reads;
+	uint32_t writes;
+} registerCount;
+
+typedef struct {
+	uint32_t occurrences;
+	uint32_t datagrams;
+} operationCount;
+
+typedef struct {
+	const char* file;
+	std::vector<traceRecord> records;
+	uint32_t dropped;
+
+	//Filled by replay()
+	uint32_t batches;
+	uint32_t datagrams;
+	uint32_t statusMismatches;
+	uint32_t dataMismatches;
+	uint64_t recorded_ns;		// First to last batch start, as recorded
+	uint64_t replayed_ns;		// Same span on the simulated bus, plus the last batch
+	uint64_t bus_ns;			// Time the bus was busy
+	registerCount registers[MCL_REGISTER_COUNT];
+	std::map<std::string, operationCount> operations;
+	std::vector<std::string> order;	// Operations in order of first appearance
+} traceRun;
+
+static const char* registerName(uint8_t addr)
+{
+	switch (addr) {
+	case MCL_GCONF:			return "GCONF";
+	case MCL_GSTAT:			return "GSTAT";
+	case MCL_IFCNT:			return "IFCNT";
+	case MCL_SLAVECONF:		return "SLAVECONF";
+	case MCL_IOIN:			return "IOIN";
+	case MCL_X_COMPARE:		return "X_COMPARE";
+	case MCL_IHOLD_IRUN:	return "IHOLD_IRUN";
+	case MCL_TPOWERDOWN:	return "TPOWERDOWN";
+	case MCL_TSTEP:			return "TSTEP";
+	case MCL_TPWMTHRS:		return "TPWMTHRS";
+	case MCL_TCOOLTHRS:		return "TCOOLTHRS";
+	case MCL_THIGH:			return "THIGH";
+	case MCL_RAMPMODE:		return "RAMPMODE";
+	case MCL_XACTUAL:		return "XACTUAL";
+	case MCL_VACTUAL:		return "VACTUAL";
+	case MCL_VSTART:		return "VSTART";
+	case MCL_A1:			return "A1";
+	case MCL_V1:			return "V1";
+	case MCL_AMAX:			return "AMAX";
+	case MCL_VMAX:			return "VMAX";
+	case MCL_DMAX:			return "DMAX";
+	case MCL_D1:			return "D1";
+	case MCL_VSTOP:			return "VSTOP";
+	case MCL_TZEROWAIT:		return "TZEROWAIT";
+	case MCL_XTARGET:		return "XTARGET";
+	case MCL_VDCMIN:		return "VDCMIN";
+	case MCL_SW_MODE:		return "SW_MODE";
+	case MCL_RAMP_STAT:		return "RAMP_STAT";
+	case MCL_XLATCH:		return "XLATCH";
+	case MCL_ENCMODE:		return "ENCMODE";
+	case MCL_X_ENC:			return "X_ENC";
+	case MCL_ENC_CONST:		return "ENC_CONST";
+	case MCL_ENC_STATUS:	return "ENC_STATUS";
+	case MCL_ENC_LATCH:		return "ENC_LATCH";
+	case MCL_MSCNT:			return "MSCNT";
+	case MCL_MSCURACT:		return "MSCURACT";
+	case MCL_CHOPCONF:		return "CHOPCONF";
+	case MCL_COOLCONF:		return "COOLCONF";
+	case MCL_DCCTRL:		return "DCCTRL";
+	case MCL_DRV_STATUS:	return "DRV_STATUS";
+	case MCL_PWMCONF:		return "PWMCONF";
+	case MCL_PWM_SCALE:		return "PWM_SCALE";
+	case MCL_ENCM_CTRL:		return "ENCM_CTRL";
+	case MCL_LOST_STEPS:	return "LOST_STEPS";
+	default:				break;
+	}
+	if (addr >= MCL_MS_LUT_0 && addr <= MCL_MS_LUTSTART) {
+		return "MS_LUT";
+	}
+	return "?";
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------------ Loading --------------------------------
+//-----------------------------------------------------------------------
+
+static bool load(const char* file, traceRun& run)
+{
+	FILE* f = fopen(file, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: can't open\n", file);
+		return false;
+	}
+
+	Thorlabs_TMC5130_trace::traceHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != MCL_TRACE_MAGIC
+		|| header.version != MCL_TRACE_VERSION || header.record_size != sizeof(traceRecord)) {
+		fprintf(stderr, "%s: not a version %u trace dump\n", file, MCL_TRACE_VERSION);
+		fclose(f);
+		return false;
+	}
+
+	run.file = file;
+	run.dropped = header.dropped;
+	run.records.resize(header.count);
+	size_t got = header.count ? fread(&run.records[0], sizeof(traceRecord), header.count, f) : 0;
+	fclose(f);
+
+	if (got != header.count) {
+		fprintf(stderr, "%s: truncated, %u of %u records\n", file, (unsigned)got, header.count);
+		run.records.resize(got);
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------------ Replay ---------------------------------
+//-----------------------------------------------------------------------
+
+static Thorlabs_TMC5130_model models[REPLAY_IDS];
+
+//Registers touched by one batch, i.e. "W:XTARGET" or "R:XACTUAL+VACTUAL". The trailing
+//read that only clocks out the last reply repeats the previous address and is folded in.
+static std::string operationName(const traceRun& run, size_t first, size_t n)
+{
+	std::string name;
+	uint8_t last = 0xFF;
+	for (size_t i = first; i < first + n; i++) {
+		uint8_t addr = run.records[i].addr;
+		if (addr == last && !(addr & MCL_WRITE_BIT)) {
+			continue;
+		}
+
+		//Direction prefix whenever it changes, registers in a run are joined with +
+		if (last == 0xFF || ((addr ^ last) & MCL_WRITE_BIT)) {
+			name += name.empty() ? "" : " ";
+			name += (addr & MCL_WRITE_BIT) ? "W:" : "R:";
+		}
+		else {
+			name += "+";
+		}
+		name += registerName(addr & ~MCL_WRITE_BIT);
+		last = addr;
+	}
+	return name;
+}
+
+static void replay(traceRun& run)
+{
+	Thorlabs_TMC5130_simbus bus(REPLAY_SPI_HZ);
+	bool seen[REPLAY_IDS] = {false};
+
+	run.batches = 0;
+	run.datagrams = 0;
+	run.statusMismatches = 0;
+	run.dataMismatches = 0;
+	run.recorded_ns = 0;
+	memset(run.registers, 0, sizeof(run.registers));
+
+	uint32_t prevTime = 0;
+	uint64_t due = 0;
+	size_t i = 0;
+	while (i < run.records.size()) {
+		//One batch: the flagged record and everything up to the next flag
+		size_t n = 1;
+		while (i + n < run.records.size() && !(run.records[i + n].flags & MCL_TRACE_BATCH)) {
+			n++;
+		}
+
+		const traceRecord& head = run.records[i];
+		Thorlabs_TMC5130_model& model = models[head.id];
+		if (!seen[head.id]) {
+			model.reset();
+			seen[head.id] = true;
+		}
+
+		//Keep the recorded spacing. Deltas are taken batch to batch so the 32 bit
+		//timestamp may wrap any number of times, as long as no gap exceeds ~4.3s.
+		if (run.batches > 0) {
+			due += (uint32_t)(head.time_ns - prevTime);
+		}
+		prevTime = head.time_ns;
+		if (due > bus.now()) {
+			bus.idle(due - bus.now());
+		}
+		run.recorded_ns = due;
+
+		bus.transaction();
+		for (size_t k = i; k < i + n; k++) {
+			const traceRecord& r = run.records[k];
+			uint8_t buf[MCL_DATAGRAM_SIZE];
+			Thorlabs_TMC5130_datagram::encode(buf, r.addr, r.tx);
+
+			bus.datagram(MCL_DATAGRAM_SIZE);
+			model.advanceTo(bus.now());
+			model.datagram(buf);
+
+			if (Thorlabs_TMC5130_datagram::status(buf) != r.status) {
+				run.statusMismatches++;
+			}
+			if ((uint32_t)Thorlabs_TMC5130_datagram::decode(buf) != r.rx) {
+				run.dataMismatches++;
+			}
+
+			uint8_t addr = r.addr & ~MCL_WRITE_BIT;
+			if (r.addr & MCL_WRITE_BIT) {
+				run.registers[addr].writes++;
+			}
+			else {
+				run.registers[addr].reads++;
+			}
+		}
+
+		std::string op = operationName(run, i, n);
+		operationCount& count = run.operations[op];
+		if (count.occurrences == 0) {
+			run.order.push_back(op);
+		}
+		count.occurrences++;
+		count.datagrams += n;
+
+		run.batches++;
+		run.datagrams += n;
+		i += n;
+	}
+
+	run.replayed_ns = bus.now();
+	run.bus_ns = bus.busy_ns;
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------------ Reports --------------------------------
+//-----------------------------------------------------------------------
+
+static void summary(const traceRun& run)
+{
+	printf("%s\n", run.file);
+	printf("  records %u (dropped before dump %u)\n", (unsigned)run.records.size(), run.dropped);
+	printf("  batches %u, datagrams %u, %.2f datagrams/batch\n", run.batches, run.datagrams,
+		run.batches ? (double)run.datagrams / run.batches : 0.0);
+	printf("  recorded span %.3f ms, replayed %.3f ms, bus busy %.3f ms at %u Hz\n",
+		run.recorded_ns / 1e6, run.replayed_ns / 1e6, run.bus_ns / 1e6, REPLAY_SPI_HZ);
+	printf("  replies differing from the model: status %u, data %u\n", run.statusMismatches, run.dataMismatches);
+}
+
+static void registerTable(const traceRun& run)
+{
+	printf("\n%-12s %8s %8s\n", "register", "reads", "writes");
+	for (size_t a = 0; a < MCL_REGISTER_COUNT; a++) {
+		const registerCount& c = run.registers[a];
+		if (c.reads || c.writes) {
+			printf("%-12s %8u %8u\n", registerName(a), c.reads, c.writes);
+		}
+	}
+}
+
+static void compareRegisters(const traceRun& base, const traceRun& cand)
+{
+	printf("\n%-12s %8s %8s %8s %8s\n", "register", "reads", "(base)", "writes", "(base)");
+	for (size_t a = 0; a < MCL_REGISTER_COUNT; a++) {
+		const registerCount& b = base.registers[a];
+		const registerCount& c = cand.registers[a];
+		if (!(b.reads || b.writes || c.reads || c.writes)) {
+			continue;
+		}
+		bool worse = (c.reads > b.reads) || (c.writes > b.writes);
+		printf("%-12s %8u %8u %8u %8u%s\n", registerName(a), c.reads, b.reads, c.writes, b.writes,
+			worse ? "  <-- more" : "");
+	}
+}
+
+static void compareOperations(const traceRun& base, const traceRun& cand)
+{
+	//Union of both, baseline order first
+	std::vector<std::string> order = base.order;
+	for (size_t i = 0; i < cand.order.size(); i++) {
+		if (!base.operations.count(cand.order[i])) {
+			order.push_back(cand.order[i]);
+		}
+	}
+
+	printf("\n%-48s %8s %8s %10s %10s\n", "operation", "count", "(base)", "datagrams", "(base)");
+	for (size_t i = 0; i < order.size(); i++) {
+		std::map<std::string, operationCount>::const_iterator b = base.operations.find(order[i]);
+		std::map<std::string, operationCount>::const_iterator c = cand.operations.find(order[i]);
+		uint32_t bCount = (b != base.operations.end()) ? b->second.occurrences : 0;
+		uint32_t bDgrams = (b != base.operations.end()) ? b->second.datagrams : 0;
+		uint32_t cCount = (c != cand.operations.end()) ? c->second.occurrences : 0;
+		uint32_t cDgrams = (c != cand.operations.end()) ? c->second.datagrams : 0;
+
+		const char* flag = "";
+		if (bCount == 0) {
+			flag = "  <-- new";
+		}
+		else if (cDgrams > bDgrams) {
+			flag = "  <-- more";
+		}
+		printf("%-48s %8u %8u %10u %10u%s\n", order[i].c_str(), cCount, bCount, cDgrams, bDgrams, flag);
+	}
+}
+
+static void compare(const traceRun& base, const traceRun& cand)
+{
+	printf("\ncandidate vs baseline\n");
+	printf("  datagrams %u vs %u (%+d)\n", cand.datagrams, base.datagrams, (int)(cand.datagrams - base.datagrams));
+	printf("  batches   %u vs %u (%+d)\n", cand.batches, base.batches, (int)(cand.batches - base.batches));
+	printf("  bus busy  %.3f ms vs %.3f ms (%+.3f ms)\n", cand.bus_ns / 1e6, base.bus_ns / 1e6,
+		((double)cand.bus_ns - (double)base.bus_ns) / 1e6);
+	printf("  replayed  %.3f ms vs %.3f ms (%+.3f ms)\n", cand.replayed_ns / 1e6, base.replayed_ns / 1e6,
+		((double)cand.replayed_ns - (double)base.replayed_ns) / 1e6);
+
+	compareRegisters(base, cand);
+	compareOperations(base, cand);
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------------ Recording ------------------------------
+//-----------------------------------------------------------------------
+
+#ifdef MCL_ENABLE_TRACE
+static bool writeFile(const void* data, size_t len, void* context)
+{
+	return fwrite(data, 1, len, (FILE*)context) == len;
+}
+
+//Reference workload: configure, then a few point to point moves polled every 10ms
+static int record(const char* file)
+{
+	static Thorlabs_TMC5130_trace trace;
+	Thorlabs_TMC5130_sim drv;
+	const int32_t targets[4] = {51200, -25600, 0, 12800};
+
+	drv.attachTrace(&trace);
+	drv.begin(0);
+	drv.setCurrentLimits(0.5, 1.0);
+	drv.enableStealthChop(true);
+	drv.setRampMode(Thorlabs_TMC5130::positionMode);
+
+	for (size_t i = 0; i < 4; i++) {
+		drv.moveTo(targets[i]);
+		do {
+			drv.advance(10000000);
+			drv.getPosition();
+		} while (!drv.isAtTarget(true));
+	}
+
+	FILE* f = fopen(file, "wb");
+	if (!f) {
+		fprintf(stderr, "%s: can't create\n", file);
+		return 1;
+	}
+	bool ok = trace.dump(writeFile, f);
+	fclose(f);
+
+	printf("%s: %u records (%u dropped, raise MCL_TRACE_DEPTH to keep them)\n", file, trace.count(), trace.dropped());
+	return ok ? 0 : 1;
+}
+#else
+static int record(const char* file)
+{
+	fprintf(stderr, "%s: --record needs a build with -DMCL_ENABLE_TRACE\n", file);
+	return 2;
+}
+#endif
+
+
+int main(int argc, char** argv)
+{
+	if (argc == 3 && strcmp(argv[1], "--record") == 0) {
+		return record(argv[2]);
+	}
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s baseline.bin [candidate.bin]\n       %s --record out.bin\n", argv[0], argv[0]);
+		return 2;
+	}
+
+	static traceRun base, cand;
+	if (!load(argv[1], base)) {
+		return 1;
+	}
+	replay(base);
+	summary(base);
+
+	if (argc == 2) {
+		registerTable(base);
+		return 0;
+	}
+
+	if (!load(argv[2], cand)) {
+		return 1;
+	}
+	replay(cand);
+	summary(cand);
+	compare(base, cand);
+	return 0;
+}
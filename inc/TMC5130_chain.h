@@ -0,0 +1,123 @@
+/**************************************************************************//**
+Daisy chain support for several TMC5130 drivers sharing one chip select.
+
+Chain position 0 is the first driver after the MCU (its SDI is wired to MOSI),
+the last position drives MISO. Every transfer shifts one datagram into each
+driver, so one frame of 5 x length bytes addresses the whole chain at once.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_CHAIN_H_
+#define INC_TMC5130_CHAIN_H_
+
+#include "TMC5130_lib.h"
+
+#ifndef MCL_CHAIN_MAX
+#define MCL_CHAIN_MAX   8	// Longest supported chain (frame buffer size)
+#endif
+
+
+class Thorlabs_TMC5130_chain {
+public:
+
+	Thorlabs_TMC5130_chain();
+
+	//Initialize chain with CS pin and number of drivers in it (1 to MCL_CHAIN_MAX). Returns false
+	//if length is out of range, the chain then has no positions and sends nothing.
+	bool begin(int8_t CS_pin, uint8_t length);
+
+	//Number of drivers in the chain
+	uint8_t length() { return _length; }
+
+	//Send one datagram to every position in a single frame. addrs[p] and data[p] go to position p,
+	//set the write bit (0x80) in addrs[p] for writes. Reply data is placed in replies[p] if not NULL.
+	//Keep in mind each reply carries the data requested by that driver's previous datagram.
+	void transfer_frame(const uint8_t* addrs, const uint32_t* data, int32_t* replies);
+
+	//Write the same register on every driver, data[p] goes to position p. One frame.
+	void write_all(uint8_t addr, const uint32_t* data);
+
+	//Read the same register from every driver into out[p]. Two frames in one transaction, regardless of length.
+	void read_all(uint8_t addr, int32_t* out);
+
+	//Read register addrs[p] from position p into out[p], same two frames. Give positions that
+	//shouldn't be disturbed a GCONF read, rather than a register that clears on read.
+	void read_frame(const uint8_t* addrs, int32_t* out);
+
+	//Set XTARGET on every driver in one frame
+	void moveTo_all(const int32_t* pos);
+
+	//Read XACTUAL from every driver
+	void getPosition_all(int32_t* out);
+
+	//SPI_STATUS byte returned by a position in the most recent frame, 0 for positions outside the chain
+	uint8_t getLastStatus(uint8_t position) { return (position < _length) ? _status[position] : 0; }
+
+	//Exchange a single datagram with one position. The other drivers receive a GCONF read,
+	//which has no side effects. Used by Thorlabs_TMC5130_chain_axis. Returns false without
+	//sending if position is outside the chain, the datagram then reads back as all 0.
+	bool transfer_single(uint8_t position, uint8_t* datagram);
+
+	//Transaction control, shared by everything on the chain
+	void begin_transaction() { Thorlabs_SPI_begin(); }
+	void end_transaction() { Thorlabs_SPI_end(); }
+
+	virtual ~Thorlabs_TMC5130_chain(){}
+
+protected:
+
+	int8_t _cs;
+	uint8_t _length;
+	uint8_t _status[MCL_CHAIN_MAX];
+
+	//Byte offset of a position's datagram within a frame
+	size_t frameOffset(uint8_t position) { return (size_t)(_length - 1 - position) * MCL_DATAGRAM_SIZE; }
+
+	//Encode, send and decode one frame, within a transaction the caller has begun
+	void exchangeFrame(const uint8_t* addrs, const uint32_t* data, int32_t* replies);
+
+	//Send a full frame and keep the status byte of every position
+	void transferFrame(uint8_t* frame);
+
+	//Our own SPI transfer to facilitate different platforms. The whole frame (count bytes)
+	//must be sent within one CS assertion.
+	virtual void Thorlabs_SPI_transfer(void *buf, size_t count);
+
+	//User-implemented SPI begin function, if needed
+	virtual void Thorlabs_SPI_begin();
+
+	//User-implemented SPI end function, if needed
+	virtual void Thorlabs_SPI_end();
+
+	//User-implemented SPI setup function, if needed
+	virtual void Thorlabs_SPI_setup();
+
+};
+
+
+//One driver within a chain. Works like a stand-alone Thorlabs_TMC5130, with every datagram
+//sent through the chain in its own frame. Call begin() once the chain has been started.
+//A NULL chain or a position of MCL_CHAIN_MAX or more leaves the axis detached: chain()
+//returns NULL and every datagram reads back as all 0 without touching the bus.
+class Thorlabs_TMC5130_chain_axis : public Thorlabs_TMC5130 {
+public:
+
+	Thorlabs_TMC5130_chain_axis(Thorlabs_TMC5130_chain* chain, uint8_t position);
+
+	Thorlabs_TMC5130_chain* chain() { return _chain; }
+	uint8_t position() { return _position; }
+
+protected:
+
+	Thorlabs_TMC5130_chain* _chain;
+	uint8_t _position;
+
+	virtual void Thorlabs_SPI_transfer(void *buf, size_t count);
+	virtual void Thorlabs_SPI_begin();
+	virtual void Thorlabs_SPI_end();
+
+};
+
+
+#endif /* INC_TMC5130_CHAIN_H_ */
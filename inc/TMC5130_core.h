@@ -0,0 +1,857 @@
+/**************************************************************************//**
+Register access and driver API shared by every TMC5130 front end.
+
+Thorlabs_TMC5130_core<Front> holds the protocol: batching and pipelining of
+register accesses, shadow registers and write suppression, status handling and
+the motion / configuration helpers. The front end only supplies the link to the
+chip, as non-virtual or virtual members it lets the core call:
+
+	void Thorlabs_SPI_setup();                             //Once, from begin()
+	void Thorlabs_SPI_begin();                             //SPI transaction begin
+	void transferDatagrams(uint8_t *buf, size_t datagrams); //Exchange back to back datagrams,
+	                                                       //then captureStatus() of the last reply
+	void Thorlabs_SPI_end();                               //SPI transaction end
+	class callScope;                                       //Constructed as callScope(Front*, name, op)
+	                                                       //around every API call, i.e. for timing
+
+Thorlabs_TMC5130 is the front end with virtual hooks, Thorlabs_TMC5130_static
+the one with a compile-time transport policy. Include TMC5130_lib.h rather than
+this header, it needs the register definitions from there.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_CORE_H_
+#define INC_TMC5130_CORE_H_
+
+#include <cstdint> //for uint8_t, etc
+#include <cstddef> //for size_t
+#include <cmath> //for sqrt
+#include "TMC5130_datagram.h"
+
+//Entries in motionProfileBatch(), and in begin()'s batch (profile + CHOPCONF + PWMCONF).
+//Sized on their own, MCL_MAX_BATCH only sets how many datagrams go out per transfer.
+#define MCL_PROFILE_REGS    7
+#define MCL_BEGIN_REGS      (MCL_PROFILE_REGS + 2)
+
+//Starter CHOPCONF/PWMCONF values used by basicMotorConfig()
+#define MCL_BASIC_CHOPCONF  0x000301D5
+#define MCL_BASIC_PWMCONF   0x000501C8
+
+
+//State every front end keeps: last status, shadow registers & write suppression, motion profile
+class Thorlabs_TMC5130_state {
+public:
+
+	typedef enum {
+		positionMode = 0x00000000,
+		velocityModePos = 0x00000001,
+		velocityModeNeg = 0x00000002,
+		holdMode = 0x00000003
+	} rampMode;
+
+	typedef struct {
+		bool reset_flag;
+		bool driver_error;
+		bool stallGuard;
+		bool standstill;
+		bool velocity_reached;
+		bool position_reached;
+		bool stop_l;
+		bool stop_r;
+	} spiStatus;
+
+	typedef struct {
+		bool status_stop_l;
+		bool status_stop_r;
+		bool status_latch_l;
+		bool status_latch_r;
+		bool event_stop_l;
+		bool event_stop_r;
+		bool event_stop_sg;
+		bool event_pos_reached;
+		bool velocity_reached;
+		bool position_reached;
+		bool vzero;
+		bool t_zerowait_active;
+		bool second_move;
+		bool status_sg;
+	} rampStatus;
+
+	//Calls handed to the front end's callScope. The ones before latencyOpCount get a latency
+	//histogram in Thorlabs_TMC5130 when MCL_ENABLE_LATENCY is defined.
+	typedef enum {
+		latencyMoveTo,
+		latencyGetPosition,
+		latencyIsStopped,
+		latencyUpdateMotionProfile,
+		latencySetCurrentLimits,
+		latencyOpCount,
+		latencyNone = latencyOpCount
+	} latencyOp;
+
+	//Shadow copy of the registers, supplied by the caller through enableShadowRegisters() so
+	//drivers that don't use it don't carry it
+	typedef struct {
+		uint32_t values[MCL_REGISTER_COUNT];
+		uint32_t valid[MCL_REGISTER_COUNT / 32];	// One bit per address, set once values[] holds it
+	} shadowRegisters;
+
+	Thorlabs_TMC5130_state();
+
+	//Keep a local shadow copy of every register written, in storage. Bitfield helpers then skip the
+	//read-back, and write-only registers can be inspected. storage is cleared here and must stay
+	//valid while enabled. NULL turns the shadow off. The shadow is cleared again when SPI_STATUS first
+	//shows the reset flag, i.e. after a chip reset. The flag stays set until GSTAT is read (begin()
+	//does), and later resets are only caught once it has been cleared.
+	void enableShadowRegisters(shadowRegisters* storage);
+
+	//Get the shadow copy of a register. Returns false if it hasn't been written or synced yet.
+	bool getShadowRegister(uint8_t addr, uint32_t* out)
+	{
+		if (!_shadow || addr >= MCL_REGISTER_COUNT) {
+			return false;
+		}
+
+		if (!(_shadow->valid[addr / 32] & (1UL << (addr % 32)))) {
+			return false;
+		}
+
+		*out = _shadow->values[addr];
+		return true;
+	}
+
+	//Note a register write that reached the chip without going through this driver (i.e. in a
+	//whole chain frame), so the shadow stays in step. Does nothing without a shadow.
+	void recordWrite(uint8_t addr, uint32_t data) { updateShadow(&addr, &data, 1); }
+
+	//Skip writes whose value already matches the shadow copy. Only has an effect while a shadow is
+	//enabled, without one to compare against nothing is redundant (see isRedundantWrite()).
+	void enableWriteSuppression(bool enabled) { _suppressWrites = enabled; }
+
+	//Number of register writes skipped by write suppression / actually sent, since the last reset
+	uint32_t getSuppressedWriteCount() { return _suppressedWrites; }
+	uint32_t getIssuedWriteCount() { return _issuedWrites; }
+	void resetWriteCounters();
+
+	//SPI_STATUS byte from the most recent datagram, read or write. No bus access.
+	uint8_t getLastStatus() { return _status; }
+
+	//Decoded version of getLastStatus()
+	spiStatus getStatus() { return decodeStatus(_status); }
+
+	//Split a raw SPI_STATUS byte into its flags
+	static spiStatus decodeStatus(uint8_t status)
+	{
+		spiStatus decoded;
+		decoded.reset_flag = status & MCL_STATUS_RESET_FLAG;
+		decoded.driver_error = status & MCL_STATUS_DRIVER_ERROR;
+		decoded.stallGuard = status & MCL_STATUS_SG2;
+		decoded.standstill = status & MCL_STATUS_STANDSTILL;
+		decoded.velocity_reached = status & MCL_STATUS_VELOCITY_REACHED;
+		decoded.position_reached = status & MCL_STATUS_POSITION_REACHED;
+		decoded.stop_l = status & MCL_STATUS_STOP_L;
+		decoded.stop_r = status & MCL_STATUS_STOP_R;
+		return decoded;
+	}
+
+	//Split a raw RAMP_STAT value into its flags
+	static rampStatus decodeRampStatus(uint32_t status)
+	{
+		rampStatus decoded;
+		decoded.status_stop_l = status & MCL_RAMP_STATUS_STOP_L;
+		decoded.status_stop_r = status & MCL_RAMP_STATUS_STOP_R;
+		decoded.status_latch_l = status & MCL_RAMP_STATUS_LATCH_L;
+		decoded.status_latch_r = status & MCL_RAMP_STATUS_LATCH_R;
+		decoded.event_stop_l = status & MCL_RAMP_EVENT_STOP_L;
+		decoded.event_stop_r = status & MCL_RAMP_EVENT_STOP_R;
+		decoded.event_stop_sg = status & MCL_RAMP_EVENT_STOP_SG;
+		decoded.event_pos_reached = status & MCL_RAMP_EVENT_POS_REACHED;
+		decoded.velocity_reached = status & MCL_RAMP_VELOCITY_REACHED;
+		decoded.position_reached = status & MCL_RAMP_POSITION_REACHED;
+		decoded.vzero = status & MCL_RAMP_VZERO;
+		decoded.t_zerowait_active = status & MCL_RAMP_T_ZEROWAIT_ACTIVE;
+		decoded.second_move = status & MCL_RAMP_SECOND_MOVE;
+		decoded.status_sg = status & MCL_RAMP_STATUS_SG;
+		return decoded;
+	}
+
+	uint32_t A1;
+	uint32_t V1;
+	uint32_t AMAX;
+	uint32_t VMAX;
+	uint32_t DMAX;
+	uint32_t D1;
+	uint32_t VSTOP;
+
+protected:
+
+	shadowRegisters* _shadow;	// NULL when disabled
+
+	bool _suppressWrites;
+	uint32_t _suppressedWrites;
+	uint32_t _issuedWrites;
+
+	uint8_t _status;
+	bool _statusFresh;	// _status came from a read and hasn't been consumed by a cached check yet
+
+	//Registers the chip changes on its own or that clear on write can't be shadowed
+	static bool is_shadowable(uint8_t addr)
+	{
+		switch (addr) {
+		case MCL_GSTAT:
+		case MCL_XACTUAL:
+		case MCL_RAMP_STAT:
+		case MCL_X_ENC:
+		case MCL_ENC_STATUS:
+			return false;
+		default:
+			return addr < MCL_REGISTER_COUNT;
+		}
+	}
+
+	//True if write suppression is on and the shadow already holds this value
+	bool isRedundantWrite(uint8_t addr, uint32_t data)
+	{
+		uint32_t current;
+
+		if (!_suppressWrites) {
+			return false;
+		}
+
+		return getShadowRegister(addr & 0x7F, &current) && current == data;
+	}
+
+	//Store written values in the shadow, if enabled
+	void updateShadow(const uint8_t* addrs, const uint32_t* data, size_t n)
+	{
+		if (!_shadow) {
+			return;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			uint8_t addr = addrs[i] & 0x7F;
+			if (is_shadowable(addr)) {
+				_shadow->values[addr] = data[i];
+				_shadow->valid[addr / 32] |= (1UL << (addr % 32));
+			}
+		}
+	}
+
+	//Keep the SPI_STATUS byte of a reply and react to a chip reset
+	void captureStatus(uint8_t status)
+	{
+		//Chip has been reset, so the shadow no longer matches it. The flag stays up until GSTAT
+		//is read, only the first status that shows it means a new reset.
+		bool reset = (status & MCL_STATUS_RESET_FLAG) && !(_status & MCL_STATUS_RESET_FLAG);
+		_status = status;
+
+		if (reset && _shadow) {
+			for (size_t i = 0; i < MCL_REGISTER_COUNT / 32; i++) {
+				_shadow->valid[i] = 0;
+			}
+		}
+	}
+
+};
+
+
+template <class Front>
+class Thorlabs_TMC5130_core : public Thorlabs_TMC5130_state {
+public:
+
+	//Set default ramp values and write them together with a basic chopper config.
+	//Reads GSTAT last, which clears the reset flag left by power-up.
+	void begin();
+
+	//Write to a specific register.
+	void write_register(uint8_t addr, uint32_t data);
+
+	//Read a specific register. Returns the SPI_STATUS bit, with requested register data
+	//located at the provided pointer
+	uint8_t read_register(uint8_t addr, int32_t* out);
+
+	//Read several registers in one transaction. The chip answers each read one datagram late,
+	//so the requests are chained and n registers cost n+1 datagrams instead of 2n.
+	//Returns the SPI_STATUS bits of the last datagram, with register data placed in out[0..n-1]
+	uint8_t read_registers(const uint8_t* addrs, size_t n, int32_t* out);
+
+	//Write several registers in one transaction. data[i] is written to addrs[i], in order.
+	void write_registers(const uint8_t* addrs, const uint32_t* data, size_t n);
+
+	//Mixed reads and writes in one transaction, in order. Entries with the write bit (0x80) set in
+	//addrs[i] write data[i], the others read into out[i]. Each datagram clocks out the reply to the
+	//one before, so reads followed by writes cost n datagrams, and n+1 when the last entry is a read.
+	//Writes are not checked against write suppression. Returns the SPI_STATUS bits of the last datagram.
+	uint8_t transfer_registers(const uint8_t* addrs, const uint32_t* data, size_t n, int32_t* out);
+
+	//Update only the bits selected by mask. Uses the shadow copy when available,
+	//otherwise reads the register from the chip first.
+	void modify_register(uint8_t addr, uint32_t mask, uint32_t value);
+
+	//Fill the shadow from the chip for registers that can be read back
+	//(GCONF, RAMPMODE, XTARGET, SW_MODE, ENCMODE, CHOPCONF).
+	void syncShadowRegisters();
+
+	//Read and decode RAMP_STAT. Reading clears second_move and the status_latch_l/r flags, so
+	//isStopped() / isAtTarget() reads in between consume them before this sees them.
+	rampStatus getRampStatus();
+
+	//Clear the sticky RAMP_STAT event flags selected by mask (defaults to all of them)
+	void clearRampEvents(uint32_t mask = MCL_RAMP_EVENTS);
+
+	//Set ramp generator between position, velocity, and hold mode
+	void setRampMode(rampMode mode);
+
+	//jog a specified number of microsteps from current position
+	void jog(int32_t uSteps);
+
+	//move to a specific position, regardless of current position
+	void moveTo(int32_t pos);
+
+	//Set VMAX. In position mode, this controls the max velocity during movement.
+	//In velocity mode, this is the target speed it will run at.
+	void setVelocity(int32_t velocity);
+
+	//Toggle to enable or disable stealthChop. Use ONLY at standstill. Recommend enabling.
+	void enableStealthChop(bool enabled);
+
+	//Toggle to swap motor direction. Intended to help correct direction after installing motor. Not intended
+	//as a quick "swap direction" during movement.
+	void reverseDirection(bool enabled);
+
+	//Manually set position register. Intended to help reset position counter on MCU restart or when homing.
+	void setPosition(int32_t pos);
+
+	//Get current stepper position from ramp genreator.
+	int32_t getPosition();
+
+	//Configure motor current limits. Set in Amps, with a max value of 1.35A. iHoldDelay scales between 1-15.
+	//Keep iHoldDelay at default value if not needed.
+	void setCurrentLimits(float iHoldCurrent, float iRunCurrent, int8_t iHoldDelay = 7);
+
+	//Call to update A1, V1, AMAX, VMAX, DMAX, D1, and VSTOP register values if changed.
+	//Values are in the chip's internal units, which scale with fCLK: velocities are
+	//v[uSteps/s] * 2^24 / fCLK, accelerations a[uSteps/s^2] * 2^41 / fCLK^2.
+	//Thorlabs_TMC5130_units (TMC5130_units.h) converts from physical units.
+	void updateMotionProfile();
+
+	//Get current encoder position
+	int32_t getEncoderPosition();
+
+	//Manually set current stepper position. Intended to help reset counter to zero on MCU restart or when homing.
+	void setEncoderPosition(int32_t pos);
+
+	//Get current velocity from ramp generator, sign extended from the 24 bit VACTUAL field.
+	int32_t getVelocity();
+
+	//Check if motor is moving or not, using RAMP_STAT vzero. With allowCachedStatus, a standstill
+	//flag carried by the last read is used instead when available, at no bus cost.
+	//The RAMP_STAT read clears second_move and status_latch_l/r, see getRampStatus().
+	bool isStopped(bool allowCachedStatus = false);
+
+	//Check if XACTUAL has reached XTARGET, using RAMP_STAT position_reached. With allowCachedStatus,
+	//the flag carried by the last read is used instead when available, at no bus cost.
+	//The RAMP_STAT read clears second_move and status_latch_l/r, see getRampStatus().
+	bool isAtTarget(bool allowCachedStatus = false);
+
+protected:
+
+	//Quick little function to set starter values to get a stepper up and running.
+	void basicMotorConfig();
+
+	//Fill addrs/data with the motion profile registers. Returns the number of entries (7),
+	//addrs and data must hold at least that many.
+	size_t motionProfileBatch(uint8_t* addrs, uint32_t* data);
+
+	//Current register value, from the shadow if valid or read from the chip otherwise
+	uint32_t current_register(uint8_t addr);
+
+private:
+
+	Front& front() { return *static_cast<Front*>(this); }
+
+};
+
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::begin()
+{
+	//Default parameters that work with most stepper setups
+	A1 = 0x000088B8;    // (35,000)
+	V1 = 0x00004E20;    // (20,000)
+	AMAX = 0x00002710;  // (10,000)
+	VMAX = 0x00030D40;  // (200,000)
+	DMAX = 0x00003A98;  // (15,000)
+	D1 = 0x0000C350;    // (50,000)
+	VSTOP = 0x0000000A; // (10)
+
+	front().Thorlabs_SPI_setup();
+
+	//Motion profile and basic config go out as one batch
+	uint8_t addrs[MCL_BEGIN_REGS];
+	uint32_t data[MCL_BEGIN_REGS];
+	size_t n = motionProfileBatch(addrs, data);
+
+	addrs[n] = MCL_CHOPCONF;
+	data[n++] = MCL_BASIC_CHOPCONF;
+	addrs[n] = MCL_PWMCONF;
+	data[n++] = MCL_BASIC_PWMCONF;
+
+	write_registers(addrs, data, n);
+
+	//Reading GSTAT clears the reset flag, so it only shows up again if the chip resets
+	int32_t gstat;
+	read_register(MCL_GSTAT, &gstat);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::write_register(uint8_t addr, uint32_t data)
+{
+	write_registers(&addr, &data, 1);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::write_registers(const uint8_t* addrs, const uint32_t* data, size_t n)
+{
+	uint8_t cmd[MCL_MAX_BATCH * MCL_DATAGRAM_SIZE];
+	size_t count = 0;
+	bool started = false;
+
+	for (size_t i = 0; i < n; i++) {
+		//Value is already in the chip, nothing to send
+		if (isRedundantWrite(addrs[i], data[i])) {
+			_suppressedWrites++;
+			continue;
+		}
+
+		//build command words back to back
+		Thorlabs_TMC5130_datagram::encodeWrite(&cmd[count * MCL_DATAGRAM_SIZE], addrs[i], data[i]);
+		count++;
+		_issuedWrites++;
+
+		//Send once the buffer is full
+		if (count == MCL_MAX_BATCH) {
+			if (!started) {
+				//Begin Transaction
+				front().Thorlabs_SPI_begin();
+				started = true;
+			}
+			front().transferDatagrams(cmd, count);
+			count = 0;
+		}
+	}
+
+	//Send whatever is left
+	if (count > 0) {
+		if (!started) {
+			//Begin Transaction
+			front().Thorlabs_SPI_begin();
+			started = true;
+		}
+		front().transferDatagrams(cmd, count);
+	}
+
+	if (started) {
+		front().Thorlabs_SPI_end();
+
+		//Status was shifted out before the writes took effect, don't trust it for motion checks
+		_statusFresh = false;
+	}
+
+	updateShadow(addrs, data, n);
+}
+
+template <class Front>
+uint8_t Thorlabs_TMC5130_core<Front>::read_register(uint8_t addr, int32_t* out)
+{
+	return read_registers(&addr, 1, out);
+}
+
+template <class Front>
+uint8_t Thorlabs_TMC5130_core<Front>::read_registers(const uint8_t* addrs, size_t n, int32_t* out)
+{
+	uint8_t cmd[MCL_MAX_BATCH * MCL_DATAGRAM_SIZE];
+	size_t total = n + 1; // one trailing datagram to clock out the last reply
+	size_t done = 0;
+
+	if (n == 0) {
+		return _status;
+	}
+
+	//Begin Transaction
+	front().Thorlabs_SPI_begin();
+
+	while (done < total) {
+		size_t count = (total - done < MCL_MAX_BATCH) ? total - done : MCL_MAX_BATCH;
+
+		//build command words. Data bytes are all 0. The trailing datagram
+		//repeats the last request, it is only sent to clock out the last reply
+		for (size_t i = 0; i < count; i++) {
+			size_t idx = done + i;
+			Thorlabs_TMC5130_datagram::encodeRead(&cmd[i * MCL_DATAGRAM_SIZE], addrs[(idx < n) ? idx : n - 1]);
+		}
+
+		front().transferDatagrams(cmd, count);
+
+		//Each reply holds the data requested by the previous datagram
+		for (size_t i = 0; i < count; i++) {
+			size_t idx = done + i;
+			if (idx > 0) {
+				out[idx - 1] = Thorlabs_TMC5130_datagram::decode(&cmd[i * MCL_DATAGRAM_SIZE]);
+			}
+		}
+		done += count;
+	}
+
+	front().Thorlabs_SPI_end();
+
+	//Reads have no side effects, so this status reflects the chip as it is now
+	_statusFresh = true;
+
+	//SPI_STATUS of the last reply, kept by transferDatagrams()
+	return _status;
+}
+
+template <class Front>
+uint8_t Thorlabs_TMC5130_core<Front>::transfer_registers(const uint8_t* addrs, const uint32_t* data, size_t n, int32_t* out)
+{
+	uint8_t cmd[MCL_MAX_BATCH * MCL_DATAGRAM_SIZE];
+	bool trailingRead;
+	size_t total;
+	size_t done = 0;
+
+	if (n == 0) {
+		return _status;
+	}
+
+	//A read at the end needs one more datagram to clock out its reply, a write doesn't
+	trailingRead = !(addrs[n - 1] & MCL_WRITE_BIT);
+	total = trailingRead ? n + 1 : n;
+
+	//Begin Transaction
+	front().Thorlabs_SPI_begin();
+
+	while (done < total) {
+		size_t count = (total - done < MCL_MAX_BATCH) ? total - done : MCL_MAX_BATCH;
+
+		//build command words, the trailing datagram repeats the last read
+		for (size_t i = 0; i < count; i++) {
+			size_t idx = done + i;
+			if (idx < n) {
+				Thorlabs_TMC5130_datagram::encode(&cmd[i * MCL_DATAGRAM_SIZE], addrs[idx],
+					(addrs[idx] & MCL_WRITE_BIT) ? data[idx] : 0);
+			}
+			else {
+				Thorlabs_TMC5130_datagram::encodeRead(&cmd[i * MCL_DATAGRAM_SIZE], addrs[n - 1]);
+			}
+		}
+
+		front().transferDatagrams(cmd, count);
+
+		//Each reply holds the data requested by the previous datagram, if it was a read
+		for (size_t i = 0; i < count; i++) {
+			size_t idx = done + i;
+			if (idx > 0 && !(addrs[idx - 1] & MCL_WRITE_BIT)) {
+				out[idx - 1] = Thorlabs_TMC5130_datagram::decode(&cmd[i * MCL_DATAGRAM_SIZE]);
+			}
+		}
+		done += count;
+	}
+
+	front().Thorlabs_SPI_end();
+
+	for (size_t i = 0; i < n; i++) {
+		if (addrs[i] & MCL_WRITE_BIT) {
+			_issuedWrites++;
+			updateShadow(&addrs[i], &data[i], 1);
+		}
+	}
+
+	//Status is only current if it was shifted out after the last write took effect
+	_statusFresh = trailingRead;
+
+	//SPI_STATUS of the last reply, kept by transferDatagrams()
+	return _status;
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::modify_register(uint8_t addr, uint32_t mask, uint32_t value)
+{
+	typename Front::callScope scope(&front(), "modify_register", latencyNone);
+	//Reset the masked bits from current config, then set them to our selection
+	uint32_t newConfig = (current_register(addr) & ~mask) | (value & mask);
+
+	write_register(addr, newConfig);
+}
+
+template <class Front>
+uint32_t Thorlabs_TMC5130_core<Front>::current_register(uint8_t addr)
+{
+	uint32_t value;
+	int32_t buf;
+
+	if (getShadowRegister(addr, &value)) {
+		return value;
+	}
+
+	read_register(addr, &buf);
+	value = buf;
+	return value;
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::syncShadowRegisters()
+{
+	typename Front::callScope scope(&front(), "syncShadowRegisters", latencyNone);
+	const uint8_t addrs[6] = {MCL_GCONF, MCL_RAMPMODE, MCL_XTARGET, MCL_SW_MODE, MCL_ENCMODE, MCL_CHOPCONF};
+	int32_t buf[6];
+	uint32_t data[6];
+
+	read_registers(addrs, 6, buf);
+
+	for (size_t i = 0; i < 6; i++) {
+		data[i] = buf[i];
+	}
+	updateShadow(addrs, data, 6);
+}
+
+template <class Front>
+Thorlabs_TMC5130_state::rampStatus Thorlabs_TMC5130_core<Front>::getRampStatus()
+{
+	typename Front::callScope scope(&front(), "getRampStatus", latencyNone);
+	int32_t buf;
+	read_register(MCL_RAMP_STAT, &buf);
+	return decodeRampStatus(buf);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::clearRampEvents(uint32_t mask)
+{
+	typename Front::callScope scope(&front(), "clearRampEvents", latencyNone);
+	//Event flags clear when written with 1
+	write_register(MCL_RAMP_STAT, mask & MCL_RAMP_EVENTS);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::jog(int32_t uSteps)
+{
+	typename Front::callScope scope(&front(), "jog", latencyNone);
+	int32_t buf;
+	int32_t target;
+
+	read_register(MCL_XACTUAL, &buf);
+	target = buf + uSteps;
+	write_register(MCL_XTARGET, target);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::moveTo(int32_t pos)
+{
+	typename Front::callScope scope(&front(), "moveTo", latencyMoveTo);
+	write_register(MCL_XTARGET, pos);
+}
+
+template <class Front>
+bool Thorlabs_TMC5130_core<Front>::isStopped(bool allowCachedStatus)
+{
+	typename Front::callScope scope(&front(), "isStopped", latencyIsStopped);
+
+	//Standstill flag only sets once no steps have been issued for a while,
+	//so it can confirm a stop for free but can't rule one out
+	if (allowCachedStatus && _statusFresh) {
+		_statusFresh = false;
+		if (_status & MCL_STATUS_STANDSTILL) {
+			return true;
+		}
+	}
+
+	int32_t buf;
+	read_register(MCL_RAMP_STAT, &buf);
+	_statusFresh = false; // already used, don't answer the next poll with the same snapshot
+	return (buf & MCL_RAMP_VZERO) != 0;
+}
+
+template <class Front>
+bool Thorlabs_TMC5130_core<Front>::isAtTarget(bool allowCachedStatus)
+{
+	typename Front::callScope scope(&front(), "isAtTarget", latencyNone);
+	//position_reached is mirrored in SPI_STATUS, so a recent read already answers this
+	if (allowCachedStatus && _statusFresh) {
+		_statusFresh = false;
+		return (_status & MCL_STATUS_POSITION_REACHED) != 0;
+	}
+
+	int32_t buf;
+	read_register(MCL_RAMP_STAT, &buf);
+	_statusFresh = false; // already used, don't answer the next poll with the same snapshot
+	return (buf & MCL_RAMP_POSITION_REACHED) != 0;
+}
+
+template <class Front>
+int32_t Thorlabs_TMC5130_core<Front>::getVelocity()
+{
+	typename Front::callScope scope(&front(), "getVelocity", latencyNone);
+	int32_t buf;
+	read_register(MCL_VACTUAL, &buf);
+
+	//VACTUAL is a 24 bit signed field
+	return Thorlabs_TMC5130_datagram::signExtend(buf, 24);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::setRampMode(rampMode mode)
+{
+	typename Front::callScope scope(&front(), "setRampMode", latencyNone);
+	write_register(MCL_RAMPMODE, mode);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::setVelocity(int32_t velocity)
+{
+	typename Front::callScope scope(&front(), "setVelocity", latencyNone);
+	VMAX = velocity;
+	write_register(MCL_VMAX, VMAX);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::enableStealthChop(bool enabled)
+{
+	typename Front::callScope scope(&front(), "enableStealthChop", latencyNone);
+	int8_t en_pwm_mode_reg_offset = 2;
+
+	//Set en_pwm_mode bit to our selection, leaving the rest of GCONF alone
+	modify_register(MCL_GCONF, 1UL << en_pwm_mode_reg_offset, (uint32_t)enabled << en_pwm_mode_reg_offset);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::reverseDirection(bool enabled)
+{
+	typename Front::callScope scope(&front(), "reverseDirection", latencyNone);
+	int8_t shaft_reg_offset = 4;
+
+	//Set shaft bit to our selection, leaving the rest of GCONF alone
+	modify_register(MCL_GCONF, 1UL << shaft_reg_offset, (uint32_t)enabled << shaft_reg_offset);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::setPosition(int32_t pos)
+{
+	typename Front::callScope scope(&front(), "setPosition", latencyNone);
+	write_register(MCL_XACTUAL, pos);
+}
+
+template <class Front>
+int32_t Thorlabs_TMC5130_core<Front>::getPosition()
+{
+	typename Front::callScope scope(&front(), "getPosition", latencyGetPosition);
+	int32_t pos;
+	read_register(MCL_XACTUAL, &pos);
+	return pos;
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::setCurrentLimits(float iHoldCurrent, float iRunCurrent, int8_t iHoldDelay)
+{
+	typename Front::callScope scope(&front(), "setCurrentLimits", latencySetCurrentLimits);
+
+	float VfsVoltage;
+	bool VfsBit;
+	float Rsense = 0.15;
+	int8_t iHold, iRun;
+
+	//If above 750mA, use Vsense scaling of 0.32V. Otherwise use scaling of 0.18V.
+	VfsVoltage = (iHoldCurrent > 0.75 || iRunCurrent > 0.75) ? 0.32 : 0.18;
+
+	//Same as above, but getting the actual register value to write
+	VfsBit = !(iHoldCurrent > 0.75 || iRunCurrent > 0.75);
+
+	//Calculate 5 bit scalar values for iHold and iRun from motor current
+	//Equation is rearranged from section 10 of TMC5130 datasheet
+	iHold = abs(((32 * sqrt(2) * iHoldCurrent * (Rsense + 0.02)) / VfsVoltage) - 1);
+	iRun = abs(((32 * sqrt(2) * iRunCurrent * (Rsense + 0.02)) / VfsVoltage) - 1);
+
+	//Format and write to IHOLD_IRUN register
+	int32_t IHOLD_IRUN_CONFIG = 0;
+	IHOLD_IRUN_CONFIG |= ((iHoldDelay & 0xF) << 16);
+	IHOLD_IRUN_CONFIG |= ((iRun & 0x1F) << 8);
+	IHOLD_IRUN_CONFIG |= (iHold & 0x1F);
+
+	//Format CHOPCONF register based on our Vfs selection
+	uint32_t currentChopconf;
+	uint32_t newChopconf;
+	uint32_t configMask;
+	int8_t vsense_reg_offset = 17;
+
+	//Get current settings so we don't overwrite anything else (shadow copy if we have one)
+	currentChopconf = current_register(MCL_CHOPCONF);
+
+	//get bitmask for our specific register
+	configMask = ~(1UL << vsense_reg_offset);
+
+	//Reset the bit that we want to modify
+	newChopconf = currentChopconf & configMask;
+
+	//Set the bit to the value we want
+	newChopconf |= ((uint32_t)VfsBit << vsense_reg_offset);
+
+	//Write newly formatted IHOLD_IRUN and CHOPCONF registers together
+	const uint8_t addrs[2] = {MCL_IHOLD_IRUN, MCL_CHOPCONF};
+	const uint32_t data[2] = {(uint32_t)IHOLD_IRUN_CONFIG, newChopconf};
+
+	write_registers(addrs, data, 2);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::updateMotionProfile()
+{
+	typename Front::callScope scope(&front(), "updateMotionProfile", latencyUpdateMotionProfile);
+	uint8_t addrs[MCL_PROFILE_REGS];
+	uint32_t data[MCL_PROFILE_REGS];
+
+	write_registers(addrs, data, motionProfileBatch(addrs, data));
+}
+
+template <class Front>
+size_t Thorlabs_TMC5130_core<Front>::motionProfileBatch(uint8_t* addrs, uint32_t* data)
+{
+	size_t n = 0;
+	addrs[n] = MCL_A1;    data[n++] = A1;    // 0x24(A1)
+	addrs[n] = MCL_V1;    data[n++] = V1;    // 0x25(V1)
+	addrs[n] = MCL_AMAX;  data[n++] = AMAX;  // 0x26(AMAX)
+	addrs[n] = MCL_VMAX;  data[n++] = VMAX;  // 0x27(VMAX)
+	addrs[n] = MCL_DMAX;  data[n++] = DMAX;  // 0x28(DMAX)
+	addrs[n] = MCL_D1;    data[n++] = D1;    // 0x2A(D1)
+	addrs[n] = MCL_VSTOP; data[n++] = VSTOP; // 0x2B(VSTOP)
+	return n;
+}
+
+template <class Front>
+int32_t Thorlabs_TMC5130_core<Front>::getEncoderPosition()
+{
+	typename Front::callScope scope(&front(), "getEncoderPosition", latencyNone);
+	int32_t pos;
+	read_register(MCL_X_ENC, &pos);
+	return pos;
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::setEncoderPosition(int32_t pos)
+{
+	typename Front::callScope scope(&front(), "setEncoderPosition", latencyNone);
+	write_register(MCL_X_ENC, pos);
+}
+
+template <class Front>
+void Thorlabs_TMC5130_core<Front>::basicMotorConfig()
+{
+	//Setting CHOPCONF in here since general user doesn't need to tweak TOFF/HSTRT values
+	//Setting PWMCONF in here since user can get funky results if manually tweaking
+	const uint8_t addrs[2] = {MCL_CHOPCONF, MCL_PWMCONF};
+	const uint32_t data[2] = {MCL_BASIC_CHOPCONF, MCL_BASIC_PWMCONF};
+
+	write_registers(addrs, data, 2);
+}
+
+
+#endif /* INC_TMC5130_CORE_H_ */
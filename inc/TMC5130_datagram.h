@@ -0,0 +1,77 @@
+/**************************************************************************//**
+Datagram encoding shared by every TMC5130 front end.
+
+Kept header-only so the packing inlines into the register access paths.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_DATAGRAM_H_
+#define INC_TMC5130_DATAGRAM_H_
+
+#include <cstdint> //for uint8_t, etc
+#include <cstring> //for memcpy
+
+//Byte swap + one 4 byte store beats four shifted byte stores (see bench/TMC5130_codec_bench.cpp)
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define MCL_DATAGRAM_BSWAP
+#endif
+
+#define MCL_DATAGRAM_SIZE   5	// 1 address/status byte + 4 data bytes
+#define MCL_WRITE_BIT       0x80
+
+
+struct Thorlabs_TMC5130_datagram {
+
+	//Pack one datagram: address byte followed by the data, MSB first
+	static inline void encode(uint8_t* cmd, uint8_t addr, uint32_t data)
+	{
+		cmd[0] = addr;
+#ifdef MCL_DATAGRAM_BSWAP
+		uint32_t be = __builtin_bswap32(data);
+		memcpy(&cmd[1], &be, 4);
+#else
+		cmd[1] = (data >> 24) & 0xFF;
+		cmd[2] = (data >> 16) & 0xFF;
+		cmd[3] = (data >> 8) & 0xFF;
+		cmd[4] = data & 0xFF;
+#endif
+	}
+
+	//Write datagram for addr
+	static inline void encodeWrite(uint8_t* cmd, uint8_t addr, uint32_t data)
+	{
+		encode(cmd, addr | MCL_WRITE_BIT, data);
+	}
+
+	//Read request for addr, data bytes are all 0
+	static inline void encodeRead(uint8_t* cmd, uint8_t addr)
+	{
+		encode(cmd, addr & ~MCL_WRITE_BIT, 0);
+	}
+
+	//Unpack the data field of a reply datagram
+	static inline int32_t decode(const uint8_t* cmd)
+	{
+		uint32_t _out = ((uint32_t) cmd[1]) << 24; // put the MSB in place
+		_out |= ((uint32_t) cmd[2]) << 16; // add next byte
+		_out |= ((uint32_t) cmd[3]) << 8; // add next byte
+		_out |= ((uint32_t) cmd[4]); // add LSB
+		return (int32_t)_out;
+	}
+
+	//SPI_STATUS byte of a reply datagram
+	static inline uint8_t status(const uint8_t* cmd)
+	{
+		return cmd[0];
+	}
+
+	//Sign extend a register field narrower than 32 bits (i.e. 24 bit VACTUAL, 20 bit DRV_STATUS fields)
+	static inline int32_t signExtend(uint32_t value, uint8_t bits)
+	{
+		return (int32_t)(value << (32 - bits)) >> (32 - bits);
+	}
+};
+
+
+#endif /* INC_TMC5130_DATAGRAM_H_ */
@@ -0,0 +1,105 @@
+/**************************************************************************//**
+Coordinated moves over several TMC5130 axes.
+
+moveTo() takes one target per axis and rescales every axis's ramp so they all
+start together, arrive together and trace a straight line in between. Each
+axis's profile is its own ramp scaled by its share of the move, relative to
+a common path profile. The path profile is the fastest that keeps every axis
+within its limits, so the axis that constrains the move runs at its own
+limits and the others get proportionally softer ramps.
+
+Limits are the profile an axis holds when it's added (A1, V1, AMAX, VMAX, DMAX,
+D1, VSTOP) and can be changed with setLimits(). That profile is taken to be in
+the chip. The scaled values are written to the chip and the driver's fields,
+and replaced on the next moveTo(). Only registers that differ from the chip go
+out: the driver's shadow is used where it has them, otherwise the values last
+written by the group. While the last SPI_STATUS shows a chip reset, all of
+them go out.
+
+Profile writes go out first, then the XTARGET writes back to back. Axes of the
+same Thorlabs_TMC5130_chain get their XTARGETs in one chain frame, so they
+start on the same clock edge. Other axes start one datagram apart. VSTART
+isn't touched and is assumed to be 0. Every axis should be at standstill in
+position mode when moveTo() is called.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_GROUP_H_
+#define INC_TMC5130_GROUP_H_
+
+#include "TMC5130_lib.h"
+#include "TMC5130_chain.h"
+#include "TMC5130_motion.h"
+
+#ifndef MCL_GROUP_MAX
+#define MCL_GROUP_MAX   8	// Axes per group
+#endif
+
+#define MCL_GROUP_PROFILE_REGS  7	// A1 to VSTOP, VSTART is left alone
+
+
+class Thorlabs_TMC5130_group {
+public:
+
+	Thorlabs_TMC5130_group();
+
+	//Add an axis, its current profile becomes its limits. Returns the axis index, -1 if the group is full.
+	int8_t addAxis(Thorlabs_TMC5130* drv);
+
+	//Same for a chain axis. Axes sharing a chain are read and started with whole chain frames.
+	//Returns -1 as well if the axis is detached or past the end of its chain.
+	int8_t addAxis(Thorlabs_TMC5130_chain_axis* axis);
+
+	//Number of axes
+	uint8_t size() { return _count; }
+
+	//Highest ramp values an axis may be given
+	void setLimits(uint8_t axis, const Thorlabs_TMC5130_motion::profile& limits) { _axes[axis].limits = limits; }
+	Thorlabs_TMC5130_motion::profile getLimits(uint8_t axis) { return _axes[axis].limits; }
+
+	//Profile an axis was given for the last move
+	Thorlabs_TMC5130_motion::profile getProfile(uint8_t axis) { return _axes[axis].profile; }
+
+	//Move every axis to targets[axis] along a straight line. Reads the start positions first.
+	//Returns the predicted duration in seconds.
+	float moveTo(const int32_t* targets);
+
+	//Same, with start positions already known (i.e. the previous targets), saving the reads
+	float moveTo(const int32_t* starts, const int32_t* targets);
+
+	//Read XACTUAL of every axis into out[axis]
+	void getPositions(int32_t* out);
+
+	//True once every axis has reached its target, from RAMP_STAT position_reached
+	bool isAtTarget();
+
+	virtual ~Thorlabs_TMC5130_group(){}
+
+protected:
+
+	typedef struct {
+		Thorlabs_TMC5130* drv;
+		Thorlabs_TMC5130_chain* chain;		// NULL for stand-alone drivers
+		uint8_t position;					// Chain position
+		Thorlabs_TMC5130_motion::profile limits;
+		Thorlabs_TMC5130_motion::profile profile;
+		uint32_t written[MCL_GROUP_PROFILE_REGS];	// Profile registers as last written
+	} axisEntry;
+
+	axisEntry _axes[MCL_GROUP_MAX];
+	uint8_t _count;
+
+	//Read one register from every axis, whole chains at a time. Chain positions outside the group read GCONF.
+	void readAll(uint8_t addr, int32_t* out);
+
+	//Write the registers of profile that differ from the chip to an axis (not XTARGET)
+	void writeProfile(uint8_t axis, const Thorlabs_TMC5130_motion::profile& profile);
+
+	//Write XTARGET of the axes with move[axis] set, chain axes one frame per chain
+	void startAll(const int32_t* targets, const bool* move);
+
+};
+
+
+#endif /* INC_TMC5130_GROUP_H_ */
@@ -0,0 +1,60 @@
+/**************************************************************************//**
+Fixed size latency histogram for the TMC5130 driver instrumentation.
+
+Buckets are log-linear like an HDR histogram: values below 2^(MCL_LATENCY_BITS+1)
+get their own bucket, above that every power of 2 is split into
+2^MCL_LATENCY_BITS buckets, so the relative error stays under
+1/2^MCL_LATENCY_BITS (12.5% with the default of 3) over the full 32 bit
+range. All buckets live in the object, recording never allocates.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_HISTOGRAM_H_
+#define INC_TMC5130_HISTOGRAM_H_
+
+#include <cstdint> //for uint8_t, etc
+#include <cstddef> //for size_t
+
+#ifndef MCL_LATENCY_BITS
+#define MCL_LATENCY_BITS    3	// Sub-buckets per power of 2 = 2^MCL_LATENCY_BITS
+#endif
+#define MCL_LATENCY_BUCKETS ((33 - MCL_LATENCY_BITS) << MCL_LATENCY_BITS)
+
+
+class Thorlabs_TMC5130_histogram {
+public:
+
+	Thorlabs_TMC5130_histogram();
+
+	//Add one sample
+	void record(uint32_t value);
+
+	//Drop all samples
+	void reset();
+
+	uint32_t count() { return _count; }
+	uint32_t min() { return _count ? _min : 0; }
+	uint32_t max() { return _max; }
+	uint32_t mean() { return _count ? (uint32_t)(_sum / _count) : 0; }
+
+	//Value at or below which the given fraction of samples fall (0.5 = p50, 0.99 = p99).
+	//Returns the top of the bucket holding it, never more than max().
+	uint32_t percentile(float fraction);
+
+	//Bucket a value lands in, and the highest value that lands in a bucket
+	static size_t bucketIndex(uint32_t value);
+	static uint32_t bucketTop(size_t index);
+
+protected:
+
+	uint32_t _buckets[MCL_LATENCY_BUCKETS];
+	uint32_t _count;
+	uint32_t _min;
+	uint32_t _max;
+	uint64_t _sum;
+
+};
+
+
+#endif /* INC_TMC5130_HISTOGRAM_H_ */
@@ -14,13 +14,27 @@ This SPI driver is used to interface the Trinamic TMC5130 Stepper Driver chip.
 #include <cstdint> //for uint8_t, etc
 #include <cstddef> //for size_t
 #include <cmath> //for sqrt
+#include "TMC5130_datagram.h"
+#ifdef MCL_ENABLE_TRACE
+#include "TMC5130_trace.h"
+#endif
+#ifdef MCL_ENABLE_LATENCY
+#include "TMC5130_histogram.h"
+#endif
+#ifdef MCL_ENABLE_TIMELINE
+#include "TMC5130_timeline.h"
+#endif
 
 //Register definitions
 #define MCL_GCONF       0x00	// (Address: 0)
+#define MCL_GSTAT       0x01    // Global status flags (clear on read)
+#define MCL_IFCNT       0x02    // Interface transmission counter (UART only)
 #define MCL_SLAVECONF 	0x03	// (Address: 1)
+#define MCL_IOIN        0x04    // Input pin states & chip version
 #define MCL_X_COMPARE 	0x05	// (Address: 2)
 #define MCL_IHOLD_IRUN  0x10	// (Address: 3)
 #define MCL_TPOWERDOWN  0x11	// (Address: 4)
+#define MCL_TSTEP       0x12    // Time between microsteps
 #define MCL_TPWMTHRS 	0x13	// (Address: 5)
 #define MCL_TCOOLTHRS 	0x14	// (Address: 6)
 #define MCL_THIGH       0x15	// (Address: 7)
@@ -39,6 +53,7 @@ This SPI driver is used to interface the Trinamic TMC5130 Stepper Driver chip.
 #define MCL_XTARGET 	0x2D	// (Address: 19)
 #define MCL_VDCMIN      0x33	// (Address: 20)
 #define MCL_SW_MODE 	0x34	// (Address: 21)
+#define MCL_RAMP_STAT   0x35    // Ramp & reference switch status register
 #define MCL_XLATCH      0x36    // XLATCH register
 #define MCL_ENCMODE 	0x38	// (Address: 22)
 #define MCL_X_ENC       0x39	// (Address: 23)
@@ -55,85 +70,145 @@ This SPI driver is used to interface the Trinamic TMC5130 Stepper Driver chip.
 #define MCL_MS_LUT_7 	0x67	// (Address: 32)
 #define MCL_MS_LUTSEL 	0x68	// (Address: 33)
 #define MCL_MS_LUTSTART 0x69	// (Address: 34)
+#define MCL_MSCNT       0x6A    // Microstep counter
+#define MCL_MSCURACT    0x6B    // Actual microstep currents
 #define MCL_CHOPCONF 	0x6C	// (Address: 35)
 #define MCL_COOLCONF 	0x6D	// (Address: 36)
 #define MCL_DCCTRL      0x6E	// (Address: 37)
+#define MCL_DRV_STATUS  0x6F    // stallGuard2 value & driver error flags
 #define MCL_PWMCONF 	0x70	// (Address: 38)
+#define MCL_PWM_SCALE   0x71    // Actual stealthChop PWM amplitude
 #define MCL_ENCM_CTRL   0x72	// (Address: 39)
-
-
-class Thorlabs_TMC5130 {
+#define MCL_LOST_STEPS  0x73    // Steps lost in dcStep mode
+
+//Datagram framing (MCL_DATAGRAM_SIZE is in TMC5130_datagram.h)
+#ifndef MCL_MAX_BATCH
+#define MCL_MAX_BATCH       9	// Datagrams encoded per transfer when batching (stack buffer size)
+#endif
+#define MCL_REGISTER_COUNT  128	// 7 bit address space
+
+//Chip clock, sets the time base of the velocity & acceleration registers
+#ifndef MCL_FCLK
+#define MCL_FCLK            12000000UL	// Internal oscillator, override if using an external clock
+#endif
+
+//SPI_STATUS bits, returned in the first byte of every reply datagram
+#define MCL_STATUS_RESET_FLAG       0x01	// GSTAT reset
+#define MCL_STATUS_DRIVER_ERROR     0x02	// GSTAT drv_err
+#define MCL_STATUS_SG2              0x04	// DRV_STATUS stallGuard
+#define MCL_STATUS_STANDSTILL       0x08	// DRV_STATUS stst
+#define MCL_STATUS_VELOCITY_REACHED 0x10	// RAMP_STAT velocity_reached
+#define MCL_STATUS_POSITION_REACHED 0x20	// RAMP_STAT position_reached
+#define MCL_STATUS_STOP_L           0x40	// RAMP_STAT status_stop_l
+#define MCL_STATUS_STOP_R           0x80	// RAMP_STAT status_stop_r
+
+//RAMP_STAT bits
+#define MCL_RAMP_STATUS_STOP_L       0x0001
+#define MCL_RAMP_STATUS_STOP_R       0x0002
+#define MCL_RAMP_STATUS_LATCH_L      0x0004	// Clears on read
+#define MCL_RAMP_STATUS_LATCH_R      0x0008	// Clears on read
+#define MCL_RAMP_EVENT_STOP_L        0x0010	// Write 1 to clear
+#define MCL_RAMP_EVENT_STOP_R        0x0020	// Write 1 to clear
+#define MCL_RAMP_EVENT_STOP_SG       0x0040	// Write 1 to clear
+#define MCL_RAMP_EVENT_POS_REACHED   0x0080	// Write 1 to clear
+#define MCL_RAMP_VELOCITY_REACHED    0x0100
+#define MCL_RAMP_POSITION_REACHED    0x0200
+#define MCL_RAMP_VZERO               0x0400
+#define MCL_RAMP_T_ZEROWAIT_ACTIVE   0x0800
+#define MCL_RAMP_SECOND_MOVE         0x1000	// Clears on read
+#define MCL_RAMP_STATUS_SG           0x2000
+#define MCL_RAMP_EVENTS              (MCL_RAMP_EVENT_STOP_L | MCL_RAMP_EVENT_STOP_R | MCL_RAMP_EVENT_STOP_SG | MCL_RAMP_EVENT_POS_REACHED)
+
+//Define MCL_ENABLE_STATS to count datagrams per register and time spent in the transport
+//(see getAccessStats()). Left undefined, none of it is compiled in.
+
+//Define MCL_ENABLE_TRACE to log datagrams into an attached Thorlabs_TMC5130_trace (see attachTrace()).
+//Left undefined, none of it is compiled in.
+
+//Define MCL_ENABLE_TIMELINE to record API calls, SPI batches and move phases into an attached
+//Thorlabs_TMC5130_timeline (see attachTimeline()). Left undefined, none of it is compiled in.
+
+//Define MCL_ENABLE_LATENCY to keep latency histograms of the main motion calls (see getLatency()).
+//Costs two Thorlabs_get_time_ns() calls per measured call and MCL_LATENCY_BUCKETS words per operation.
+
+//Register access and driver API, shared with Thorlabs_TMC5130_static
+#include "TMC5130_core.h"
+
+
+class Thorlabs_TMC5130 : public Thorlabs_TMC5130_core<Thorlabs_TMC5130> {
 public:
 	//TODO Add more helper functions for setting up driver (hold & run current,
 	//stealthChop/coolStep/fullStep thresholds, etc)
 
-	typedef enum {
-		positionMode = 0x00000000,
-		velocityModePos = 0x00000001,
-		velocityModeNeg = 0x00000002,
-		holdMode = 0x00000003
-	} rampMode;
+	//Called from completeAsync() once an async transfer has finished. May run in interrupt context.
+	typedef void (*asyncCallback)(void* context);
+
+#ifdef MCL_ENABLE_STATS
+	//Bus usage since the last resetAccessStats(). Times come from Thorlabs_get_time_ns().
+	typedef struct {
+		uint32_t reads[MCL_REGISTER_COUNT];		// Read datagrams sent per address, pipeline datagrams included
+		uint32_t writes[MCL_REGISTER_COUNT];	// Write datagrams sent per address
+		uint32_t transfers;						// Batches handed to the transport, async ones included
+		uint64_t transfer_ns;					// Time spent in blocking transfers
+	} accessStats;
+#endif
+
+	//Descriptor for one async register access. Owned by the caller, must stay valid until complete.
+	typedef struct {
+		uint8_t buf[2 * MCL_DATAGRAM_SIZE];	// Datagrams to send, replaced by the received data
+		size_t datagrams;			// 1 for writes, 2 for reads
+		uint8_t addr;
+		uint32_t data;				// Value written, kept to update the shadow on completion
+		int32_t* out;				// Read destination, NULL for writes
+		asyncCallback callback;
+		void* context;
+		uint8_t status;				// SPI_STATUS of the reply
+		volatile bool complete;
+	} asyncTransfer;
+
+	Thorlabs_TMC5130();
 
 	//Initialize object with SPI bus & CS pin, set default ramp values.
+	//Reads GSTAT last, which clears the reset flag left by power-up.
 	void begin(int8_t CS_pin);
 
-	//Write to a specific register.
-	void write_register(uint8_t addr, uint32_t data);
-
-	//Read a specific register. Returns the SPI_STATUS bit, with requested register data
-	//located at the provided pointer
-	uint8_t read_register(uint8_t addr, int32_t* out);
-
-	//Set ramp generator between position, velocity, and hold mode
-	void setRampMode(rampMode mode);
-
-	//jog a specified number of microsteps from current position
-	void jog(int32_t uSteps);
-
-	//move to a specific position, regardless of current position
-	void moveTo(int32_t pos);
-
-	//Set VMAX. In position mode, this controls the max velocity during movement.
-	//In velocity mode, this is the target speed it will run at.
-	void setVelocity(int32_t velocity);
-
-	//Toggle to enable or disable stealthChop. Use ONLY at standstill. Recommend enabling.
-	void enableStealthChop(bool enabled);
-
-	//Toggle to swap motor direction. Intended to help correct direction after installing motor. Not intended
-	//as a quick "swap direction" during movement.
-	void reverseDirection(bool enabled);
-
-	//Manually set position register. Intended to help reset position counter on MCU restart or when homing.
-	void setPosition(int32_t pos);
-
-	//Get current stepper position from ramp genreator.
-	int32_t getPosition();
-
-	//Configure motor current limits. Set in Amps, with a max value of 1.35A. iHoldDelay scales between 1-15.
-	//Keep iHoldDelay at default value if not needed.
-	void setCurrentLimits(float iHoldCurrent, float iRunCurrent, int8_t iHoldDelay = 7);
-
-	//Call to update A1, V1, AMAX, VMAX, DMAX, D1, and VSTOP register values if changed.
-	//All values are in uSteps/second
-	void updateMotionProfile();
-
-	//Get current encoder position
-	int32_t getEncoderPosition();
-
-	//Manually set current stepper position. Intended to help reset counter to zero on MCU restart or when homing.
-	void setEncoderPosition(int32_t pos);
-
-	//Check if motor is moving or not.
-	bool isStopped();
-
-	uint32_t A1;
-	uint32_t V1;
-	uint32_t AMAX;
-	uint32_t VMAX;
-	uint32_t DMAX;
-	uint32_t D1;
-	uint32_t VSTOP;
+	//Non-blocking register access. Returns once the transfer is submitted, completion is signalled
+	//through xfer->complete and the optional callback. Only one transfer per object should be
+	//in flight unless your transport queues them.
+	void write_register_async(uint8_t addr, uint32_t data, asyncTransfer* xfer, asyncCallback callback = NULL, void* context = NULL);
+	void read_register_async(uint8_t addr, int32_t* out, asyncTransfer* xfer, asyncCallback callback = NULL, void* context = NULL);
+
+	//Non-blocking versions of getPosition() and moveTo()
+	void getPosition_async(int32_t* out, asyncTransfer* xfer, asyncCallback callback = NULL, void* context = NULL);
+	void moveTo_async(int32_t pos, asyncTransfer* xfer, asyncCallback callback = NULL, void* context = NULL);
+
+	//Poll for completion of an async transfer
+	static bool isComplete(const asyncTransfer* xfer) { return xfer->complete; }
+
+#ifdef MCL_ENABLE_STATS
+	//Copy the access counters into out
+	void getAccessStats(accessStats* out) { *out = _accessStats; }
+	void resetAccessStats();
+#endif
+
+#ifdef MCL_ENABLE_LATENCY
+	//Latency of op in Thorlabs_get_time_ns() units, measured around the whole call
+	//(begin, transfers, end and any read-back). Query with percentile(0.5), percentile(0.99), max().
+	Thorlabs_TMC5130_histogram& getLatency(latencyOp op) { return _latency[op]; }
+	void resetLatency();
+#endif
+
+#ifdef MCL_ENABLE_TRACE
+	//Log every datagram exchanged by this driver into trace, tagged with id. NULL detaches.
+	//Timestamps come from Thorlabs_get_time_ns().
+	void attachTrace(Thorlabs_TMC5130_trace* trace, uint8_t id = 0);
+#endif
+
+#ifdef MCL_ENABLE_TIMELINE
+	//Record API calls, SPI batches and move phases into timeline, on the tracks of driver id
+	//and bus. Drivers sharing a bus should share a timeline and bus id. NULL detaches.
+	void attachTimeline(Thorlabs_TMC5130_timeline* timeline, uint8_t id = 0, uint8_t bus = 0);
+#endif
 
 	virtual ~Thorlabs_TMC5130(){}
 
@@ -141,12 +216,56 @@ protected:
 
 	int8_t _cs;
 
-	//Quick little function to set starter values to get a stepper up and running.
-	void basicMotorConfig();
+	//Hand datagrams to the transport and keep the SPI_STATUS byte of the last reply
+	void transferDatagrams(uint8_t *buf, size_t datagrams);
+
+	//Keep the SPI_STATUS byte of a reply and react to a chip reset (and move the timeline phase)
+	void captureStatus(uint8_t status);
+
+	//Wraps every API call of the core. Records the time from construction to destruction into the
+	//call's latency histogram and as an API span on the timeline, for whichever is compiled in.
+	class callScope {
+	public:
+#if defined(MCL_ENABLE_LATENCY) || defined(MCL_ENABLE_TIMELINE)
+		callScope(Thorlabs_TMC5130* drv, const char* name, latencyOp op);
+		~callScope();
+	private:
+		Thorlabs_TMC5130* _drv;
+		const char* _name;
+		latencyOp _op;
+		bool _timed;
+		uint32_t _start;
+#else
+		callScope(Thorlabs_TMC5130*, const char*, latencyOp) {}
+#endif
+	};
+
+#ifdef MCL_ENABLE_TIMELINE
+	//Move the timeline phase track (MCL_TIMELINE_STATUS / MCL_TIMELINE_MODEL) to name, if attached
+	void timelinePhase(uint8_t kind, const char* name, uint32_t time_ns);
+#endif
+
+#ifdef MCL_ENABLE_STATS
+	//Count the datagrams in buf per address, before they're sent
+	void countDatagrams(const uint8_t* buf, size_t datagrams);
+#endif
 
 	//Our own SPI transfer to facilitate different platforms
 	virtual void Thorlabs_SPI_transfer(void *buf, size_t count);
 
+	//Transfer several back-to-back datagrams (MCL_DATAGRAM_SIZE bytes each) within one transaction.
+	//Default calls Thorlabs_SPI_transfer once per datagram. Override if your platform can send the
+	//whole buffer at once while toggling CS between datagrams.
+	virtual void Thorlabs_SPI_transfer_datagrams(uint8_t *buf, size_t datagrams);
+
+	//Start an async transfer of xfer->datagrams datagrams from xfer->buf and return. Call
+	//completeAsync(xfer) once the data has been received (i.e. from a DMA complete interrupt).
+	//Default runs the blocking begin/transfer/end sequence and completes immediately.
+	virtual void Thorlabs_SPI_transfer_async(asyncTransfer* xfer);
+
+	//Finish an async transfer: decode the reply, update status & shadow, then notify the caller
+	void completeAsync(asyncTransfer* xfer);
+
 	//User-implemented SPI begin function, if needed
 	virtual void Thorlabs_SPI_begin();
 
@@ -155,12 +274,40 @@ protected:
 
 	//User-implemented SPI setup function, if needed
 	virtual void Thorlabs_SPI_setup();
+
+	//User-implemented timestamp for the trace, timeline, stats and latency features, if needed
+	//(i.e. a free running timer in ns)
+	virtual uint32_t Thorlabs_get_time_ns();
 	
 
 private:
 
+	//The core drives the SPI hooks, transferDatagrams() and callScope
+	friend class Thorlabs_TMC5130_core<Thorlabs_TMC5130>;
+
+#ifdef MCL_ENABLE_TRACE
+	Thorlabs_TMC5130_trace* _trace;
+	uint8_t _traceId;
+#endif
+
+#ifdef MCL_ENABLE_TIMELINE
+	Thorlabs_TMC5130_timeline* _timeline;
+	uint8_t _timelineId;
+	uint8_t _timelineBus;
+#endif
+
+#ifdef MCL_ENABLE_STATS
+	accessStats _accessStats;
+#endif
+
+#ifdef MCL_ENABLE_LATENCY
+	Thorlabs_TMC5130_histogram _latency[latencyOpCount];
+#endif
 
 };
 
+//Compiled once in TMC5130_lib.cpp
+extern template class Thorlabs_TMC5130_core<Thorlabs_TMC5130>;
+
 
 #endif /* INC_TMC5130_LIB_H_ */
@@ -0,0 +1,66 @@
+/**************************************************************************//**
+Closed form timing of TMC5130 position mode moves.
+
+Works from the ramp registers alone (VSTART, A1, V1, AMAX, VMAX, DMAX, D1,
+VSTOP and the chip clock), so move durations can be planned without touching
+the bus or stepping a simulation. Follows the six point ramp: VSTART -> A1 ->
+V1 -> AMAX -> VMAX -> cruise -> DMAX -> V1 -> D1 -> VSTOP, with A1/D1 dropped
+when V1 = 0 and the cruise/upper phases shortened or dropped when the move is
+too short to reach VMAX or V1.
+
+Register units: v[usteps/s] = reg * fCLK / 2^24, a[usteps/s^2] = reg * fCLK^2 / 2^41.
+
+bench/TMC5130_motion_bench.cpp compares the phase times with the simulated chip.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_MOTION_H_
+#define INC_TMC5130_MOTION_H_
+
+#include "TMC5130_lib.h"
+
+
+class Thorlabs_TMC5130_motion {
+public:
+
+	//Ramp register values, as written to the chip
+	typedef struct {
+		uint32_t VSTART;
+		uint32_t A1;
+		uint32_t V1;
+		uint32_t AMAX;
+		uint32_t VMAX;
+		uint32_t DMAX;
+		uint32_t D1;
+		uint32_t VSTOP;
+	} profile;
+
+	//Predicted move, times in seconds
+	typedef struct {
+		float a1;			// Accelerating with A1 (below V1)
+		float amax;			// Accelerating with AMAX (above V1)
+		float cruise;		// At VMAX
+		float dmax;			// Decelerating with DMAX (above V1)
+		float d1;			// Decelerating with D1 (below V1) down to VSTOP
+		float total;
+		float peak;			// Highest velocity reached, usteps/s
+	} moveTime;
+
+	//Profile currently held by a driver (the fields updateMotionProfile() writes).
+	//The driver doesn't keep VSTART, pass it if you've changed it from its reset value of 0.
+	static profile fromDriver(const Thorlabs_TMC5130_state& drv, uint32_t vstart = 0);
+
+	//Duration and phase times of a move from start to target, starting and ending at rest.
+	//A profile that needs a zero A1/AMAX/DMAX/D1 to get anywhere, or has VMAX = 0, comes back
+	//with total = INFINITY.
+	static moveTime estimate(const profile& p, int32_t start, int32_t target, uint32_t fclk = MCL_FCLK);
+
+	//Register value to physical unit
+	static float velocity(uint32_t reg, uint32_t fclk = MCL_FCLK);		// usteps/s
+	static float acceleration(uint32_t reg, uint32_t fclk = MCL_FCLK);	// usteps/s^2
+
+};
+
+
+#endif /* INC_TMC5130_MOTION_H_ */
@@ -0,0 +1,151 @@
+/**************************************************************************//**
+Motion command queue for one TMC5130 driver.
+
+Holds a short list of position mode moves, VMAX changes and full ramp profiles,
+and streams them into the driver as soon as the previous move has arrived, so
+point to point patterns don't lose a polling interval plus a status read
+between every pair of moves.
+
+Call poll() from the main loop or a timer. While a move is under way, poll()
+stays off the bus until the arrival predicted by Thorlabs_TMC5130_motion (less
+margin_us), then reads XACTUAL on every call until SPI_STATUS shows
+position_reached. Velocity and profile commands are merged and go out in the
+same batch as the XTARGET of the next move. The gap between arrival and the
+next move is therefore at most one poll period plus one read and one batch write.
+
+A move that doesn't arrive raises a fault instead of being polled forever: the
+chip reset or flagged a driver error, the motor is at standstill past the
+predicted arrival (stall, stop switch) or with a profile that can't move, or
+timeout_us has passed since the predicted arrival. The queue then holds
+everything until clearFault().
+
+The driver must be in position mode. Moves that the driver is given outside
+the queue aren't tracked. The driver's profile fields are taken to be in the
+chip when the queue is constructed (i.e. after begin() or updateMotionProfile()).
+Only registers that differ from the chip go out: the driver's shadow is used
+where it has them, otherwise the values last written by the queue. Fields
+changed directly on the driver go out with the next batch.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_QUEUE_H_
+#define INC_TMC5130_QUEUE_H_
+
+#include "TMC5130_lib.h"
+#include "TMC5130_motion.h"
+
+#ifndef MCL_QUEUE_DEPTH
+#define MCL_QUEUE_DEPTH     16		// Commands held (40 bytes each), must be a power of 2
+#endif
+
+#define MCL_QUEUE_PROFILE_REGS  8	// VSTART to VSTOP
+
+//Command types
+#define MCL_QUEUE_MOVE      0	// Move to an absolute position
+#define MCL_QUEUE_VELOCITY  1	// VMAX for the following moves
+#define MCL_QUEUE_PROFILE   2	// Whole ramp profile for the following moves
+
+
+class Thorlabs_TMC5130_queue {
+public:
+
+	typedef struct {
+		uint8_t type;		// MCL_QUEUE_*
+		int32_t value;		// Target position, or VMAX
+		Thorlabs_TMC5130_motion::profile profile;	// MCL_QUEUE_PROFILE only
+	} command;
+
+	Thorlabs_TMC5130_queue(Thorlabs_TMC5130* drv);
+
+	//Queue a command. Returns false if the queue is full.
+	bool moveTo(int32_t pos);
+	bool setVelocity(uint32_t vmax);
+	bool setProfile(const Thorlabs_TMC5130_motion::profile& profile);
+
+	//Drop the queued commands. A move already sent to the driver carries on.
+	void clear();
+
+	//Feed the driver if it's time to. now_us is any free running microsecond clock, the same one
+	//on every call. Returns true if a batch was written to the driver.
+	bool poll(uint32_t now_us);
+
+	//Commands waiting, and room left
+	uint32_t pending() { return _head - _tail; }
+	uint32_t space() { return MCL_QUEUE_DEPTH - pending(); }
+
+	//A move has been sent and hasn't been seen arriving yet
+	bool isMoving() { return _moving; }
+
+	//Nothing queued and nothing moving
+	bool isIdle() { return !_moving && pending() == 0; }
+
+	//The last move sent didn't arrive. poll() does nothing until clearFault().
+	bool hasFault() { return _fault; }
+
+	//SPI_STATUS of the read that raised the fault
+	uint8_t faultStatus() { return _faultStatus; }
+
+	//Give up on the failed move and carry on with the queued commands from wherever the motor
+	//is now. Call clear() first to drop them instead. The reset and driver error flags stay up
+	//until GSTAT is read, so after one of those run begin() (and the motor setup) first.
+	void clearFault();
+
+	//Earliest now_us at which poll() will touch the bus for the current move, to sleep until
+	uint32_t nextCheck() { return _checkAt; }
+
+	//Moves sent to the driver / seen arriving, since construction
+	uint32_t issued() { return _issued; }
+	uint32_t completed() { return _completed; }
+
+	//Target of the last move sent, and the position last read from the driver
+	int32_t target() { return _target; }
+	int32_t position() { return _position; }
+
+	//Status reads start this long before the predicted arrival, to cover clock and rounding error
+	uint32_t margin_us;
+
+	//A move still not there this long after the predicted arrival is a fault. Moves too long
+	//to predict have no deadline, ones that can never arrive (see estimate()) fault on standstill.
+	uint32_t timeout_us;
+
+	//Chip clock used for the arrival prediction
+	uint32_t fclk;
+
+protected:
+
+	Thorlabs_TMC5130* _drv;
+
+	command _commands[MCL_QUEUE_DEPTH];
+	uint32_t _head;		// Next slot to write, free running
+	uint32_t _tail;		// Oldest command, free running
+
+	//VSTART isn't kept by the driver, so it lives here
+	uint32_t _vstart;
+
+	//Profile registers as last written, in profile order (see profileAddrs)
+	uint32_t _written[MCL_QUEUE_PROFILE_REGS];
+
+	bool _moving;
+	bool _positionValid;
+	bool _fault;
+	uint8_t _faultStatus;
+	bool _hasDeadline;
+	bool _watchStandstill;
+	uint32_t _checkAt;
+	uint32_t _arriveAt;		// Predicted arrival
+	uint32_t _deadline;		// _arriveAt + timeout_us
+	int32_t _target;
+	int32_t _position;
+	uint32_t _issued;
+	uint32_t _completed;
+
+	bool push(const command& c);
+
+	//Send pending profile changes and the next move, if any
+	bool feed(uint32_t now_us);
+
+};
+
+
+#endif /* INC_TMC5130_QUEUE_H_ */
@@ -0,0 +1,281 @@
+/**************************************************************************//**
+Software model of the TMC5130, usable as a drop-in transport.
+
+Thorlabs_TMC5130_model decodes 40 bit datagrams against a full register file
+with the chip's access rules (read/write, write-only, clear-on-read,
+write-1-to-clear) and returns read data one datagram late like the real chip.
+Thorlabs_TMC5130_sim wires the model to the Thorlabs_TMC5130 transport hooks
+and counts every datagram, byte and transaction, so any API can be exercised
+and measured on a host without hardware.
+
+The model also runs the six-point ramp generator (VSTART, A1, V1, AMAX, VMAX,
+DMAX, D1, VSTOP, TZEROWAIT) in position, velocity and hold mode, stepped in
+simulated time, so move durations and polling costs can be measured offline.
+
+Bus time is modelled by Thorlabs_TMC5130_simbus. Several simulated drivers can
+share one bus, in which case their transfers serialize on it.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_SIM_H_
+#define INC_TMC5130_SIM_H_
+
+#include "TMC5130_lib.h"
+
+//Register access types
+#define MCL_SIM_R       0x01	// Readable
+#define MCL_SIM_W       0x02	// Writable
+#define MCL_SIM_RC      0x04	// Clears on read
+#define MCL_SIM_WC      0x08	// Write 1 to clear bits
+
+
+class Thorlabs_TMC5130_model {
+public:
+
+	//What the ramp generator is doing right now
+	typedef enum {
+		phaseStopped,
+		phaseA1,		// Accelerating below V1 (A1)
+		phaseAMAX,		// Accelerating above V1 (AMAX), or any acceleration in velocity mode
+		phaseCruise,	// At VMAX
+		phaseDMAX,		// Decelerating above V1 (DMAX), or any deceleration in velocity mode
+		phaseD1,		// Decelerating below V1 towards VSTOP (D1)
+		phaseZeroWait	// Stopped, waiting out TZEROWAIT
+	} rampPhase;
+
+	//Called whenever the ramp phase changes, with the simulated time of the change
+	typedef void (*phaseCallback)(void* context, rampPhase phase, uint64_t time_ns);
+
+	Thorlabs_TMC5130_model();
+
+	//Power-on reset: default register values, GSTAT reset flag set
+	void reset();
+
+	//Exchange one datagram in place. buf holds MCL_DATAGRAM_SIZE bytes to send and
+	//is replaced with the reply (SPI_STATUS + data requested by the previous datagram).
+	void datagram(uint8_t* buf);
+
+	//Bring the model up to simulated time now_ns, running the ramp generator
+	void advanceTo(uint64_t now_ns);
+	uint64_t now() { return _timeNs; }
+
+	//Current ramp phase and velocity (microsteps/s, signed)
+	rampPhase phase() { return _phase; }
+	double velocity() { return _velocity; }
+
+	//Printable name of a phase
+	static const char* phaseName(rampPhase phase);
+
+	//Get told about phase changes, i.e. to draw them on a timeline. NULL to stop.
+	void setPhaseCallback(phaseCallback callback, void* context);
+
+	//Chip clock (defaults to MCL_FCLK) and ramp integration step
+	uint32_t fclk;
+	uint32_t step_ns;
+
+	//Direct register access for tests & benches, bypasses access rules and the read pipeline
+	uint32_t peek(uint8_t addr);
+	void poke(uint8_t addr, uint32_t value);
+
+	//Reference switch inputs (1 = active, after polarity). When enabled in SW_MODE, an active
+	//switch hard stops motion towards it.
+	void setSwitches(bool stop_l, bool stop_r);
+
+	//SPI_STATUS byte the chip would shift out right now
+	uint8_t spiStatus();
+
+	//Access type (MCL_SIM_*) and implemented bits of a register
+	static uint8_t access(uint8_t addr);
+	static uint32_t mask(uint8_t addr);
+
+	//Datagram counters, per register
+	uint32_t reads[MCL_REGISTER_COUNT];
+	uint32_t writes[MCL_REGISTER_COUNT];
+
+protected:
+
+	uint32_t _regs[MCL_REGISTER_COUNT];
+	uint32_t _latched;		// Read data waiting to go out with the next reply
+	uint64_t _timeNs;
+	double _position;		// Exact position, XACTUAL is this rounded
+	double _velocity;		// microsteps/s, signed
+	uint64_t _zerowaitUntilNs;
+	uint64_t _lastStepNs;
+	rampPhase _phase;
+	rampPhase _reportedPhase;
+	uint32_t _brakeTarget;	// XTARGET the current deceleration is for
+	phaseCallback _phaseCallback;
+	void* _phaseContext;
+	bool _stop_l;
+	bool _stop_r;
+
+	//Register values converted to microsteps/s and microsteps/s^2
+	double regVelocity(uint8_t addr);
+	double regAccel(uint8_t addr);
+
+	//VACTUAL register value for the current velocity
+	int32_t vactual();
+
+	//Distance needed to slow from speed down to VSTOP
+	double brakingDistance(double speed);
+
+	//Nothing will change until a register is written
+	bool isIdle();
+
+	//Run the ramp generator for dt seconds
+	void step(double dt);
+	void stepPosition(double dt);
+	void stepVelocity(double dt, double target);
+
+	//Tell the phase callback if the phase changed since it was last told
+	void reportPhase();
+
+	//Move by distance, keeping XACTUAL/X_ENC and the standstill timer in sync
+	void move(double distance);
+
+	//Register value as seen by a read, with live status fields filled in
+	uint32_t readRegister(uint8_t addr);
+	void writeRegister(uint8_t addr, uint32_t data);
+
+	uint32_t rampStat();
+
+};
+
+
+//Timing & traffic model for one SPI bus
+class Thorlabs_TMC5130_simbus {
+public:
+
+	//spi_hz sets the byte time, cs_gap_ns is added after every datagram and
+	//transaction_ns once per begin/end pair (i.e. bus locking, CS setup)
+	Thorlabs_TMC5130_simbus(uint32_t spi_hz = 4000000, uint32_t cs_gap_ns = 100, uint32_t transaction_ns = 0);
+
+	uint64_t now() { return _timeNs; }
+
+	//Let the bus sit idle for ns
+	void idle(uint64_t ns) { _timeNs += ns; }
+
+	//Occupy the bus for one datagram of count bytes. Waits for a background transfer to finish first.
+	void datagram(size_t count);
+
+	//Occupy the bus for transaction setup. Waits for a background transfer to finish first.
+	void transaction();
+
+	//Time one datagram of count bytes takes on the bus
+	uint64_t datagramNs(size_t count) { return ((uint64_t)count * 8 * 1000000000ULL) / spi_hz + cs_gap_ns; }
+
+	//Earliest time the bus can start something new, later than now() while a background transfer runs
+	uint64_t freeAt() { return (_freeNs > _timeNs) ? _freeNs : _timeNs; }
+
+	//Occupy the bus in the background (i.e. DMA) with one transaction of datagrams, count bytes each,
+	//starting at freeAt(). The clock doesn't move. Returns the time the transfer ends.
+	uint64_t background(size_t datagrams, size_t count);
+
+	void resetStats();
+
+	uint32_t spi_hz;
+	uint32_t cs_gap_ns;
+	uint32_t transaction_ns;
+
+	//Traffic counters
+	uint32_t datagrams;
+	uint32_t bytes;
+	uint32_t transactions;
+	uint64_t busy_ns;
+
+protected:
+
+	uint64_t _timeNs;
+	uint64_t _freeNs;	// End of the last background transfer
+
+};
+
+
+//Thorlabs_TMC5130 running against a Thorlabs_TMC5130_model
+class Thorlabs_TMC5130_sim : public Thorlabs_TMC5130 {
+public:
+
+	typedef struct {
+		uint32_t datagrams;
+		uint32_t bytes;
+		uint32_t begins;		// Thorlabs_SPI_begin calls
+		uint32_t ends;			// Thorlabs_SPI_end calls
+		uint32_t transfers;		// Thorlabs_SPI_transfer calls
+		uint64_t bus_ns;		// Simulated bus time used by this driver
+	} simStats;
+
+	//Uses its own bus unless one is given
+	Thorlabs_TMC5130_sim(Thorlabs_TMC5130_simbus* bus = NULL);
+
+	Thorlabs_TMC5130_model model;
+
+	Thorlabs_TMC5130_simbus* bus() { return _bus; }
+
+	//Simulated time of this driver's bus
+	uint64_t now() { return _bus->now(); }
+
+	//Let simulated time pass without bus traffic. Completes pending async transfers that are due.
+	void advance(uint64_t ns);
+
+	//Complete a pending async transfer if the bus has caught up with it. Returns true if one completed.
+	bool poll();
+
+	simStats getSimStats() { return _stats; }
+	void resetSimStats();
+
+protected:
+
+	Thorlabs_TMC5130_simbus _ownBus;
+	Thorlabs_TMC5130_simbus* _bus;
+	simStats _stats;
+
+	asyncTransfer* _pending;
+	uint64_t _pendingDone;
+
+	virtual void Thorlabs_SPI_transfer(void *buf, size_t count);
+	virtual void Thorlabs_SPI_begin();
+	virtual void Thorlabs_SPI_end();
+
+	//Simulated bus time
+	virtual uint32_t Thorlabs_get_time_ns();
+
+#ifdef MCL_ENABLE_TIMELINE
+	//Model phases go onto the MCL_TIMELINE_MODEL track
+	static void modelPhase(void* context, Thorlabs_TMC5130_model::rampPhase phase, uint64_t time_ns);
+#endif
+
+	//The transfer runs in the background from when the bus is free, the clock doesn't move. Datagrams
+	//are exchanged with the model at submission, at the bus time each one ends. Completion fires once
+	//the clock has passed the end of the transfer (see advance() / poll()).
+	virtual void Thorlabs_SPI_transfer_async(asyncTransfer* xfer);
+
+};
+
+
+//Transport policy for Thorlabs_TMC5130_static, backed by a model
+class Thorlabs_TMC5130_sim_transport {
+public:
+
+	Thorlabs_TMC5130_sim_transport() : bus(&_ownBus) {}
+
+	Thorlabs_TMC5130_model model;
+	Thorlabs_TMC5130_simbus* bus;
+
+	inline void begin() { bus->transaction(); }
+	inline void end() {}
+	inline void transfer(uint8_t *buf, size_t count)
+	{
+		bus->datagram(count);
+		model.advanceTo(bus->now());
+		model.datagram(buf);
+	}
+
+protected:
+
+	Thorlabs_TMC5130_simbus _ownBus;
+
+};
+
+
+#endif /* INC_TMC5130_SIM_H_ */
@@ -0,0 +1,68 @@
+/**************************************************************************//**
+Linux spidev transport for the TMC5130 driver.
+
+Batched reads and writes are submitted as one SPI_IOC_MESSAGE ioctl holding one
+spi_ioc_transfer per datagram, with cs_change set between them, so a whole
+motion profile update costs a single syscall.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_SPIDEV_H_
+#define INC_TMC5130_SPIDEV_H_
+
+#if defined(__linux__)
+
+#include "TMC5130_lib.h"
+#include <linux/spi/spidev.h>
+
+
+class Thorlabs_TMC5130_spidev : public Thorlabs_TMC5130 {
+public:
+
+	//device is the spidev node, i.e. "/dev/spidev0.0". TMC5130 supports up to 4MHz SCK on the internal clock.
+	Thorlabs_TMC5130_spidev(const char* device, uint32_t speed_hz = 4000000);
+
+	virtual ~Thorlabs_TMC5130_spidev();
+
+	//True once the device has been opened and configured by begin()
+	bool isOpen() { return _fd >= 0; }
+
+	//errno of the last failed open/ioctl, 0 if none
+	int lastError() { return _lastError; }
+
+	//Number of SPI_IOC_MESSAGE calls issued so far
+	uint32_t getIoctlCount() { return _ioctls; }
+
+protected:
+
+	const char* _device;
+	uint32_t _speed;
+	int _fd;
+	int _lastError;
+	uint32_t _ioctls;
+
+	//Opens the device and sets SPI mode 3, 8 bit words and the bus speed
+	virtual void Thorlabs_SPI_setup();
+
+	virtual void Thorlabs_SPI_transfer(void *buf, size_t count);
+
+	//All datagrams go out in one ioctl, with CS released between them
+	virtual void Thorlabs_SPI_transfer_datagrams(uint8_t *buf, size_t datagrams);
+
+	//CLOCK_MONOTONIC, for the trace, timeline, stats and latency features
+	virtual uint32_t Thorlabs_get_time_ns();
+
+	//Submit a prepared message. Override to route transfers to a fake device or simulator.
+	//Returns the ioctl result (negative on error). On error the receive buffers are zeroed,
+	//so a failed transfer reads back as 0 with no SPI_STATUS flags.
+	virtual int spidev_message(struct spi_ioc_transfer* xfers, size_t n);
+
+	//Every ioctl on the device goes through here. Override to check requests against a fake fd.
+	virtual int spidev_ioctl(unsigned long request, void* arg);
+
+};
+
+#endif /* __linux__ */
+
+#endif /* INC_TMC5130_SPIDEV_H_ */
@@ -0,0 +1,87 @@
+/**************************************************************************//**
+Compile-time transport variant of the TMC5130 driver.
+
+The transport is a template policy instead of a set of virtual functions, so
+the whole encode / transfer / decode path can inline into the caller. Meant
+for tight servo loops where Thorlabs_TMC5130's indirect calls show up.
+
+A transport policy is any class providing:
+
+	void begin();                               //SPI transaction begin, if needed
+	void transfer(uint8_t *buf, size_t count);  //One datagram per call, CS framed
+	void end();                                 //SPI transaction end, if needed
+
+Register access, shadow registers, write suppression, status handling and the
+motion helpers come from Thorlabs_TMC5130_core, the same code Thorlabs_TMC5130
+runs. Only async transfers, stats, trace, timeline and latency histograms are
+left to the virtual front end.
+
+The same policy can back the full Thorlabs_TMC5130 API through
+Thorlabs_TMC5130_adapter<Transport>, which keeps existing code working.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_STATIC_H_
+#define INC_TMC5130_STATIC_H_
+
+#include "TMC5130_lib.h"
+
+
+template <class Transport>
+class Thorlabs_TMC5130_static : public Thorlabs_TMC5130_core<Thorlabs_TMC5130_static<Transport> > {
+public:
+
+	//Transport instance, configure it directly (pins, bus handle, etc)
+	Transport transport;
+
+	//position_reached from the status byte of the last datagram. Free, but only as recent as that datagram.
+	inline bool lastStatusAtTarget() { return (this->_status & MCL_STATUS_POSITION_REACHED) != 0; }
+
+protected:
+
+	//The core drives the link below
+	friend class Thorlabs_TMC5130_core<Thorlabs_TMC5130_static<Transport> >;
+
+	//Nothing to time, compiles away
+	class callScope {
+	public:
+		inline callScope(Thorlabs_TMC5130_static*, const char*, Thorlabs_TMC5130_state::latencyOp) {}
+	};
+
+	inline void Thorlabs_SPI_setup() {}
+	inline void Thorlabs_SPI_begin() { transport.begin(); }
+	inline void Thorlabs_SPI_end() { transport.end(); }
+
+	//One datagram per transport call, each in its own CS frame
+	inline void transferDatagrams(uint8_t *buf, size_t datagrams)
+	{
+		for (size_t i = 0; i < datagrams; i++) {
+			transport.transfer(&buf[i * MCL_DATAGRAM_SIZE], MCL_DATAGRAM_SIZE);
+		}
+
+		//Every reply starts with SPI_STATUS, the last one is the most recent
+		this->captureStatus(buf[(datagrams - 1) * MCL_DATAGRAM_SIZE]);
+	}
+
+};
+
+
+//Full Thorlabs_TMC5130 API on top of a transport policy. The virtual hooks just forward
+//to the policy, so one transport implementation serves both front ends.
+template <class Transport>
+class Thorlabs_TMC5130_adapter : public Thorlabs_TMC5130 {
+public:
+
+	Transport transport;
+
+protected:
+
+	virtual void Thorlabs_SPI_transfer(void *buf, size_t count) { transport.transfer((uint8_t*)buf, count); }
+	virtual void Thorlabs_SPI_begin() { transport.begin(); }
+	virtual void Thorlabs_SPI_end() { transport.end(); }
+
+};
+
+
+#endif /* INC_TMC5130_STATIC_H_ */
@@ -0,0 +1,74 @@
+/**************************************************************************//**
+Velocity streaming for a host side servo loop on one TMC5130 driver.
+
+Every update() sends a signed velocity setpoint and reads back XACTUAL (and
+optionally X_ENC) in a single pipelined transaction. The sign picks
+velocityModePos or velocityModeNeg and the magnitude goes to VMAX. Only the
+registers that changed since the last update are written. The reads go first,
+so the writes clock out the last reply. With the encoder read on:
+
+  setpoint unchanged      R XACTUAL, R X_ENC, R X_ENC               3 datagrams
+  new speed               R XACTUAL, R X_ENC, W VMAX                3 datagrams
+  new speed, reversed     R XACTUAL, R X_ENC, W VMAX, W RAMPMODE    4 datagrams
+
+Positions are sampled before the new setpoint is applied. Acceleration comes
+from AMAX, set it with updateMotionProfile() before streaming.
+
+When SPI_STATUS shows a chip reset, VMAX and RAMPMODE are written again on
+every update until the flag is cleared. The rest of the setup (AMAX, currents)
+is gone as well, so check update()'s return value and re-run begin() and the
+motor setup.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_STREAM_H_
+#define INC_TMC5130_STREAM_H_
+
+#include "TMC5130_lib.h"
+
+#define MCL_STREAM_VMAX_LIMIT   0x7FFFFF	// VMAX is a 23 bit field
+
+
+class Thorlabs_TMC5130_stream {
+public:
+
+	//readEncoder adds X_ENC to every update, leave it off without an encoder to save a datagram
+	Thorlabs_TMC5130_stream(Thorlabs_TMC5130* drv, bool readEncoder = false);
+
+	//Apply a signed velocity setpoint (VMAX units, clamped to 23 bits) and read back the positions.
+	//Returns the SPI_STATUS bits of the last datagram.
+	uint8_t update(int32_t velocity);
+
+	//Positions read by the last update()
+	int32_t position() { return _position; }
+	int32_t encoder() { return _encoder; }
+
+	//Setpoint in effect after the last update()
+	int32_t velocity() { return _velocity; }
+
+	//Forget what the chip holds, i.e. after RAMPMODE or VMAX were written elsewhere.
+	//The next update() writes both.
+	void reset() { _known = false; }
+
+	//Datagrams sent by the last update()
+	uint8_t lastDatagrams() { return _lastDatagrams; }
+
+protected:
+
+	Thorlabs_TMC5130* _drv;
+	bool _readEncoder;
+
+	bool _known;		// _mode and _vmax match the chip
+	Thorlabs_TMC5130::rampMode _mode;
+	uint32_t _vmax;
+
+	int32_t _velocity;
+	int32_t _position;
+	int32_t _encoder;
+	uint8_t _lastDatagrams;
+
+};
+
+
+#endif /* INC_TMC5130_STREAM_H_ */
@@ -0,0 +1,110 @@
+/**************************************************************************//**
+Timeline recorder for the TMC5130 driver, exported as Chrome trace JSON.
+
+Attach a Thorlabs_TMC5130_timeline to one or more drivers with attachTimeline()
+and it collects spans for every API call, every SPI batch and every move phase
+into a fixed size ring buffer. dump() writes them in the Chrome trace event
+format, which chrome://tracing and ui.perfetto.dev open directly:
+
+  driver N   process per driver id, with an "api" track, a "motion (status)"
+             track of the phases seen in SPI_STATUS and, on the simulator, a
+             "motion (model)" track of the ramp generator's real phases
+  bus N      process per bus id, one span per batch of datagrams, so idle gaps
+             and transfers serialized behind other drivers stand out
+
+Span names are not copied, they must point to string literals or other storage
+that outlives the dump.
+
+The driver hooks are only compiled in with MCL_ENABLE_TIMELINE defined.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_TIMELINE_H_
+#define INC_TMC5130_TIMELINE_H_
+
+#include <cstdint> //for uint8_t, etc
+#include <cstddef> //for size_t
+
+#ifndef MCL_TIMELINE_DEPTH
+#define MCL_TIMELINE_DEPTH      512		// Spans kept (24 bytes each on 32 bit targets), must be a power of 2
+#endif
+#ifndef MCL_TIMELINE_DRIVERS
+#define MCL_TIMELINE_DRIVERS    32		// Driver ids with phase tracking (0 .. n-1)
+#endif
+
+//Span kinds, each one is its own track
+#define MCL_TIMELINE_API        0	// Public API call, on the driver
+#define MCL_TIMELINE_SPI        1	// Batch of datagrams, on the bus
+#define MCL_TIMELINE_STATUS     2	// Move phase derived from SPI_STATUS, on the driver
+#define MCL_TIMELINE_MODEL      3	// Move phase of the simulated ramp generator, on the driver
+
+
+class Thorlabs_TMC5130_timeline {
+public:
+
+	typedef struct {
+		uint64_t start_ns;
+		uint64_t end_ns;
+		const char* name;
+		uint8_t kind;		// MCL_TIMELINE_*
+		uint8_t driver;
+		uint8_t bus;
+		uint8_t datagrams;	// MCL_TIMELINE_SPI only
+	} span;
+
+	//Called by dump() for every chunk of output. Return false to stop the dump.
+	typedef bool (*timelineWriter)(const void* data, size_t len, void* context);
+
+	Thorlabs_TMC5130_timeline();
+
+	//Drop all spans and open phases
+	void clear();
+
+	//Spans currently held, and spans overwritten since the last clear()
+	uint32_t count() { return (_head - _tail); }
+	uint32_t dropped() { return _dropped; }
+
+	//Copy the i-th oldest span into out. Returns false if i is out of range.
+	bool get(uint32_t i, span* out);
+
+	//Add a finished span. Times are Thorlabs_get_time_ns() values, wraps are unrolled
+	//as long as consecutive calls are less than ~2s apart.
+	void add(uint8_t kind, const char* name, uint8_t driver, uint8_t bus, uint32_t start_ns, uint32_t end_ns, uint8_t datagrams = 0);
+
+	//Switch the phase track (MCL_TIMELINE_STATUS or MCL_TIMELINE_MODEL) of a driver to name,
+	//closing the previous phase as a span. NULL ends the current phase without starting one.
+	//Repeating the current name does nothing.
+	void phase(uint8_t kind, const char* name, uint8_t driver, uint32_t time_ns);
+
+	//End every open phase at time_ns, i.e. right before dumping
+	void closePhases(uint32_t time_ns);
+
+	//Write the spans as Chrome trace JSON. Returns false if the writer gave up.
+	bool dump(timelineWriter writer, void* context);
+
+protected:
+
+	span _spans[MCL_TIMELINE_DEPTH];
+	uint32_t _head;		// Next slot to write, free running
+	uint32_t _tail;		// Oldest span, free running
+	uint32_t _dropped;
+
+	//Wrap unrolling of the 32 bit timestamps
+	bool _timeValid;
+	uint32_t _lastTime;
+	int64_t _lastFull;
+
+	//Open phase per driver, [0] = MCL_TIMELINE_STATUS, [1] = MCL_TIMELINE_MODEL
+	const char* _phaseName[MCL_TIMELINE_DRIVERS][2];
+	uint64_t _phaseStart[MCL_TIMELINE_DRIVERS][2];
+
+	//Extend a 32 bit timestamp to 64 bits, relative to the previous one
+	uint64_t unroll(uint32_t time_ns);
+
+	void push(const span& s);
+
+};
+
+
+#endif /* INC_TMC5130_TIMELINE_H_ */
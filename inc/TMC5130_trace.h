@@ -0,0 +1,103 @@
+/**************************************************************************//**
+Binary SPI trace recorder for the TMC5130 driver.
+
+Attach a Thorlabs_TMC5130_trace to a driver with attachTrace() and every
+datagram it exchanges is logged into a fixed size ring buffer: timestamp,
+address byte (write bit = direction), data sent, SPI_STATUS and data received.
+Records are 16 bytes and nothing is allocated, so a trace can stay attached on
+a production axis and be dumped once something goes wrong.
+
+Dump format (host byte order): one traceHeader followed by count records,
+oldest first.
+
+The driver hooks are only compiled in with MCL_ENABLE_TRACE defined.
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_TRACE_H_
+#define INC_TMC5130_TRACE_H_
+
+#include <cstdint> //for uint8_t, etc
+#include <cstddef> //for size_t
+
+#ifndef MCL_TRACE_DEPTH
+#define MCL_TRACE_DEPTH     256	// Records kept, must be a power of 2
+#endif
+
+#define MCL_TRACE_MAGIC     0x54434D54UL	// "TMCT" in a little endian dump
+#define MCL_TRACE_VERSION   1
+
+//Record flags
+#define MCL_TRACE_BATCH     0x01	// First datagram of a batch handed to the transport
+#define MCL_TRACE_ASYNC     0x02	// Sent through the async path, time is the completion time
+
+
+class Thorlabs_TMC5130_trace {
+public:
+
+	typedef struct {
+		uint32_t time_ns;	// From Thorlabs_get_time_ns() when the batch started, wraps every ~4.3s
+		uint8_t addr;		// Address byte sent, MCL_WRITE_BIT set for writes
+		uint8_t status;		// SPI_STATUS received
+		uint8_t flags;		// MCL_TRACE_*
+		uint8_t id;			// Driver id given to attachTrace(), so drivers can share a trace
+		uint32_t tx;		// Data sent
+		uint32_t rx;		// Data received (answer to the previous datagram)
+	} record;
+
+	typedef struct {
+		uint32_t magic;			// MCL_TRACE_MAGIC
+		uint16_t version;		// MCL_TRACE_VERSION
+		uint16_t record_size;	// sizeof(record)
+		uint32_t count;			// Records that follow
+		uint32_t dropped;		// Older records overwritten before the dump
+	} traceHeader;
+
+	//Called by dump() for every chunk of output. Return false to stop the dump.
+	typedef bool (*traceWriter)(const void* data, size_t len, void* context);
+
+	Thorlabs_TMC5130_trace();
+
+	//Drop all records
+	void clear();
+
+	//Pause/resume recording, i.e. freeze the buffer once a fault has been detected
+	void setEnabled(bool enabled) { _enabled = enabled; }
+	bool isEnabled() { return _enabled; }
+
+	//Records currently held, and records overwritten since the last clear()
+	uint32_t count() { return (_head - _tail); }
+	uint32_t dropped() { return _dropped; }
+
+	//Copy the i-th oldest record into out. Returns false if i is out of range.
+	bool get(uint32_t i, record* out);
+
+	//Write header + records, oldest first. Returns false if the writer gave up.
+	bool dump(traceWriter writer, void* context);
+
+	//Log the datagrams about to be sent. Returns the slot of the first one for complete().
+	//Both are called by Thorlabs_TMC5130 around every transfer.
+	uint32_t submit(const uint8_t* buf, size_t datagrams, uint32_t time_ns, uint8_t id, uint8_t flags);
+
+	//Fill in the replies for datagrams logged by submit()
+	void complete(uint32_t slot, const uint8_t* buf, size_t datagrams);
+
+	//Log one datagram whose sent bytes are no longer available (async completion)
+	void log(uint8_t addr, uint32_t tx, const uint8_t* reply, uint32_t time_ns, uint8_t id, uint8_t flags);
+
+protected:
+
+	record _records[MCL_TRACE_DEPTH];
+	uint32_t _head;		// Next slot to write, free running
+	uint32_t _tail;		// Oldest record, free running
+	uint32_t _dropped;
+	bool _enabled;
+
+	//Claim the next slot, overwriting the oldest record if full
+	record* claim();
+
+};
+
+
+#endif /* INC_TMC5130_TRACE_H_ */
@@ -0,0 +1,190 @@
+/**************************************************************************//**
+Physical unit conversion for the TMC5130 ramp registers, in fixed point.
+
+The velocity and acceleration registers aren't in microsteps per second, they
+scale with the chip clock:
+
+  v[usteps/s]   = reg * fCLK / 2^24         reg = v * 2^24 / fCLK
+  a[usteps/s^2] = reg * fCLK^2 / 2^41       reg = a * 2^41 / fCLK^2
+
+Thorlabs_TMC5130_units<STEPS_NUM, STEPS_DEN, FCLK> converts from a unit of your
+choice, with STEPS_NUM / STEPS_DEN microsteps per unit. Every scale factor is
+folded at compile time into a 32 bit multiplier and a shift, so a conversion at
+run time is one 32x32->64 multiply and a shift, with no FPU or division. All
+functions are constexpr, so constant arguments fold away entirely.
+
+Inputs are whole units, so pick a unit fine enough for the resolution you need:
+
+	//200 step motor, 256 microsteps, 2mm lead: 25600 usteps/mm = 128/5 usteps/um
+	typedef Thorlabs_TMC5130_units<128, 5> um;
+	drv.VMAX = um::velocity(20000);         // 20 mm/s
+	drv.AMAX = um::acceleration(100000);    // 100 mm/s^2
+	drv.moveTo(um::position(-1500));        // -1.5 mm
+
+	//Same motor on a rotary stage, in millidegrees: 51200 / 360000 = 16 / 1125
+	typedef Thorlabs_TMC5130_units<16, 1125> mdeg;
+
+******************************************************************************/
+
+
+#ifndef INC_TMC5130_UNITS_H_
+#define INC_TMC5130_UNITS_H_
+
+#include "TMC5130_lib.h"
+
+//Largest values the register fields hold
+#define MCL_UNITS_VELOCITY_MAX      0x7FFFFF	// VMAX, 23 bits
+#define MCL_UNITS_ACCEL_MAX         0xFFFF		// A1, AMAX, DMAX, D1, 16 bits
+
+
+//Compile time helpers to turn a ratio into a multiplier and shift
+class Thorlabs_TMC5130_fixed {
+public:
+
+	static constexpr double pow2(int s) { return (s == 0) ? 1.0 : 2.0 * pow2(s - 1); }
+
+	//Largest shift (up to 63) that keeps ratio * 2^shift below 2^32 - 1, so the rounded
+	//multiplier still fits in 32 bits
+	static constexpr int shift(double ratio, int s = 0)
+	{
+		return (s < 63 && ratio * pow2(s + 1) < 4294967295.0) ? shift(ratio, s + 1) : s;
+	}
+
+	static constexpr uint32_t multiplier(double ratio)
+	{
+		return (uint32_t)(ratio * pow2(shift(ratio)) + 0.5);
+	}
+
+	//value * multiplier / 2^shift, rounded to nearest and clamped to limit
+	static constexpr uint32_t scale(uint32_t value, uint32_t mul, int shift, uint32_t limit = 0xFFFFFFFF)
+	{
+		return clamp((((uint64_t)value * mul) + ((shift > 0) ? (1ULL << (shift - 1)) : 0)) >> shift, limit);
+	}
+
+	//Register counts per unit for steps = num / den microsteps per unit
+	static constexpr double velocityRatio(uint32_t num, uint32_t den, uint32_t fclk)
+	{
+		return (double)num * 16777216.0 / ((double)den * fclk);
+	}
+
+	static constexpr double accelerationRatio(uint32_t num, uint32_t den, uint32_t fclk)
+	{
+		return (double)num * 2199023255552.0 / ((double)den * fclk * fclk);
+	}
+
+	//Ratio and its inverse both turn into 32 bit multipliers
+	static constexpr bool inRange(double ratio)
+	{
+		return ratio < 4294967295.0 && 1.0 / ratio < 4294967295.0;
+	}
+
+	static constexpr uint32_t clamp(uint64_t value, uint32_t limit)
+	{
+		return (value > limit) ? limit : (uint32_t)value;
+	}
+
+	//Signed version of scale(), rounds away from zero symmetrically
+	static constexpr int32_t scaleSigned(int32_t value, uint32_t mul, int shift, uint32_t limit = 0x7FFFFFFF)
+	{
+		return (value < 0) ? -(int32_t)scale((uint32_t)(-(int64_t)value), mul, shift, limit)
+			: (int32_t)scale((uint32_t)value, mul, shift, limit);
+	}
+
+};
+
+
+template <uint32_t STEPS_NUM, uint32_t STEPS_DEN = 1, uint32_t FCLK = MCL_FCLK>
+class Thorlabs_TMC5130_units {
+public:
+
+	static_assert(STEPS_NUM > 0 && STEPS_DEN > 0, "steps per unit must be positive");
+	static_assert(FCLK > 0, "FCLK must be positive");
+
+	//Register values for the velocity fields (VSTART, V1, VMAX, VSTOP), from units/s
+	static constexpr uint32_t velocity(uint32_t units)
+	{
+		return Thorlabs_TMC5130_fixed::scale(units, VEL_MUL, VEL_SHIFT, MCL_UNITS_VELOCITY_MAX);
+	}
+
+	//Signed units/s, i.e. for a velocity mode setpoint (magnitude to VMAX, sign to RAMPMODE)
+	static constexpr int32_t signedVelocity(int32_t units)
+	{
+		return Thorlabs_TMC5130_fixed::scaleSigned(units, VEL_MUL, VEL_SHIFT, MCL_UNITS_VELOCITY_MAX);
+	}
+
+	//Register values for the acceleration fields (A1, AMAX, DMAX, D1), from units/s^2
+	static constexpr uint32_t acceleration(uint32_t units)
+	{
+		return Thorlabs_TMC5130_fixed::scale(units, ACC_MUL, ACC_SHIFT, MCL_UNITS_ACCEL_MAX);
+	}
+
+	//Microsteps (XTARGET, XACTUAL), from units
+	static constexpr int32_t position(int32_t units)
+	{
+		return Thorlabs_TMC5130_fixed::scaleSigned(units, POS_MUL, POS_SHIFT);
+	}
+
+	//And back, i.e. for VACTUAL (after sign extension) and XACTUAL readings
+	static constexpr int32_t toVelocity(int32_t reg)
+	{
+		return Thorlabs_TMC5130_fixed::scaleSigned(reg, VEL_INV_MUL, VEL_INV_SHIFT);
+	}
+
+	static constexpr uint32_t toAcceleration(uint32_t reg)
+	{
+		return Thorlabs_TMC5130_fixed::scale(reg, ACC_INV_MUL, ACC_INV_SHIFT);
+	}
+
+	static constexpr int32_t toPosition(int32_t usteps)
+	{
+		return Thorlabs_TMC5130_fixed::scaleSigned(usteps, POS_INV_MUL, POS_INV_SHIFT);
+	}
+
+private:
+
+	//Register counts per unit, only evaluated by the compiler
+	static constexpr double VEL_RATIO = Thorlabs_TMC5130_fixed::velocityRatio(STEPS_NUM, STEPS_DEN, FCLK);
+	static constexpr double ACC_RATIO = Thorlabs_TMC5130_fixed::accelerationRatio(STEPS_NUM, STEPS_DEN, FCLK);
+	static constexpr double POS_RATIO = (double)STEPS_NUM / STEPS_DEN;
+
+	static_assert(Thorlabs_TMC5130_fixed::inRange(VEL_RATIO), "velocity scale out of range");
+	static_assert(Thorlabs_TMC5130_fixed::inRange(ACC_RATIO), "acceleration scale out of range");
+
+public:
+
+	//Multipliers and shifts behind the conversions
+	static constexpr int VEL_SHIFT = Thorlabs_TMC5130_fixed::shift(VEL_RATIO);
+	static constexpr uint32_t VEL_MUL = Thorlabs_TMC5130_fixed::multiplier(VEL_RATIO);
+	static constexpr int ACC_SHIFT = Thorlabs_TMC5130_fixed::shift(ACC_RATIO);
+	static constexpr uint32_t ACC_MUL = Thorlabs_TMC5130_fixed::multiplier(ACC_RATIO);
+	static constexpr int POS_SHIFT = Thorlabs_TMC5130_fixed::shift(POS_RATIO);
+	static constexpr uint32_t POS_MUL = Thorlabs_TMC5130_fixed::multiplier(POS_RATIO);
+
+	static constexpr int VEL_INV_SHIFT = Thorlabs_TMC5130_fixed::shift(1.0 / VEL_RATIO);
+	static constexpr uint32_t VEL_INV_MUL = Thorlabs_TMC5130_fixed::multiplier(1.0 / VEL_RATIO);
+	static constexpr int ACC_INV_SHIFT = Thorlabs_TMC5130_fixed::shift(1.0 / ACC_RATIO);
+	static constexpr uint32_t ACC_INV_MUL = Thorlabs_TMC5130_fixed::multiplier(1.0 / ACC_RATIO);
+	static constexpr int POS_INV_SHIFT = Thorlabs_TMC5130_fixed::shift(1.0 / POS_RATIO);
+	static constexpr uint32_t POS_INV_MUL = Thorlabs_TMC5130_fixed::multiplier(1.0 / POS_RATIO);
+
+};
+
+//Definitions for the constants, in case they're odr-used
+template <uint32_t N, uint32_t D, uint32_t F> constexpr double Thorlabs_TMC5130_units<N, D, F>::VEL_RATIO;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr double Thorlabs_TMC5130_units<N, D, F>::ACC_RATIO;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr double Thorlabs_TMC5130_units<N, D, F>::POS_RATIO;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr int Thorlabs_TMC5130_units<N, D, F>::VEL_SHIFT;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr uint32_t Thorlabs_TMC5130_units<N, D, F>::VEL_MUL;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr int Thorlabs_TMC5130_units<N, D, F>::ACC_SHIFT;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr uint32_t Thorlabs_TMC5130_units<N, D, F>::ACC_MUL;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr int Thorlabs_TMC5130_units<N, D, F>::POS_SHIFT;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr uint32_t Thorlabs_TMC5130_units<N, D, F>::POS_MUL;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr int Thorlabs_TMC5130_units<N, D, F>::VEL_INV_SHIFT;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr uint32_t Thorlabs_TMC5130_units<N, D, F>::VEL_INV_MUL;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr int Thorlabs_TMC5130_units<N, D, F>::ACC_INV_SHIFT;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr uint32_t Thorlabs_TMC5130_units<N, D, F>::ACC_INV_MUL;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr int Thorlabs_TMC5130_units<N, D, F>::POS_INV_SHIFT;
+template <uint32_t N, uint32_t D, uint32_t F> constexpr uint32_t Thorlabs_TMC5130_units<N, D, F>::POS_INV_MUL;
+
+
+#endif /* INC_TMC5130_UNITS_H_ */
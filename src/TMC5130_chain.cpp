@@ -0,0 +1,231 @@
+/*
+ * TMC5130_chain.cpp
+ *
+ *  Daisy chained TMC5130 drivers behind one chip select
+ */
+
+#include "TMC5130_chain.h"
+
+Thorlabs_TMC5130_chain::Thorlabs_TMC5130_chain()
+{
+	_cs = -1;
+	_length = 0;
+	for (size_t i = 0; i < MCL_CHAIN_MAX; i++) {
+		_status[i] = 0;
+	}
+}
+
+bool Thorlabs_TMC5130_chain::begin(int8_t CS_pin, uint8_t length)
+{
+	_cs = CS_pin;
+
+	//A frame longer than the buffer can't be built, and a clamped chain would address the wrong drivers
+	if (length == 0 || length > MCL_CHAIN_MAX) {
+		_length = 0;
+		return false;
+	}
+	_length = length;
+
+	Thorlabs_SPI_setup();
+	return true;
+}
+
+void Thorlabs_TMC5130_chain::transfer_frame(const uint8_t* addrs, const uint32_t* data, int32_t* replies)
+{
+	if (_length == 0) {
+		return;
+	}
+
+	//Begin Transaction
+	Thorlabs_SPI_begin();
+
+	exchangeFrame(addrs, data, replies);
+
+	Thorlabs_SPI_end();
+}
+
+void Thorlabs_TMC5130_chain::exchangeFrame(const uint8_t* addrs, const uint32_t* data, int32_t* replies)
+{
+	uint8_t frame[MCL_CHAIN_MAX * MCL_DATAGRAM_SIZE];
+
+	//build one command word per position
+	for (uint8_t p = 0; p < _length; p++) {
+		Thorlabs_TMC5130_datagram::encode(&frame[frameOffset(p)], addrs[p], data[p]);
+	}
+
+	transferFrame(frame);
+
+	if (replies) {
+		for (uint8_t p = 0; p < _length; p++) {
+			replies[p] = Thorlabs_TMC5130_datagram::decode(&frame[frameOffset(p)]);
+		}
+	}
+}
+
+void Thorlabs_TMC5130_chain::write_all(uint8_t addr, const uint32_t* data)
+{
+	uint8_t addrs[MCL_CHAIN_MAX];
+
+	for (uint8_t p = 0; p < _length; p++) {
+		addrs[p] = addr | MCL_WRITE_BIT;
+	}
+
+	transfer_frame(addrs, data, NULL);
+}
+
+void Thorlabs_TMC5130_chain::read_all(uint8_t addr, int32_t* out)
+{
+	uint8_t addrs[MCL_CHAIN_MAX];
+
+	for (uint8_t p = 0; p < _length; p++) {
+		addrs[p] = addr;
+	}
+
+	read_frame(addrs, out);
+}
+
+void Thorlabs_TMC5130_chain::read_frame(const uint8_t* addrs, int32_t* out)
+{
+	uint8_t reads[MCL_CHAIN_MAX];
+	uint32_t data[MCL_CHAIN_MAX];
+
+	for (uint8_t p = 0; p < _length; p++) {
+		reads[p] = addrs[p] & ~MCL_WRITE_BIT;
+		data[p] = 0;
+	}
+
+	if (_length == 0) {
+		return;
+	}
+
+	//Begin Transaction
+	Thorlabs_SPI_begin();
+
+	//First frame requests the register, second one clocks out the replies
+	exchangeFrame(reads, data, NULL);
+	exchangeFrame(reads, data, out);
+
+	Thorlabs_SPI_end();
+}
+
+void Thorlabs_TMC5130_chain::moveTo_all(const int32_t* pos)
+{
+	uint32_t data[MCL_CHAIN_MAX];
+
+	for (uint8_t p = 0; p < _length; p++) {
+		data[p] = pos[p];
+	}
+
+	write_all(MCL_XTARGET, data);
+}
+
+void Thorlabs_TMC5130_chain::getPosition_all(int32_t* out)
+{
+	read_all(MCL_XACTUAL, out);
+}
+
+bool Thorlabs_TMC5130_chain::transfer_single(uint8_t position, uint8_t* datagram)
+{
+	uint8_t frame[MCL_CHAIN_MAX * MCL_DATAGRAM_SIZE];
+
+	//Nobody there to answer, don't hand the sent bytes back as a reply
+	if (position >= _length) {
+		for (size_t i = 0; i < MCL_DATAGRAM_SIZE; i++) {
+			datagram[i] = 0;
+		}
+		return false;
+	}
+
+	//Everyone else gets a harmless GCONF read
+	for (size_t i = 0; i < (size_t)_length * MCL_DATAGRAM_SIZE; i++) {
+		frame[i] = 0;
+	}
+	for (size_t i = 0; i < MCL_DATAGRAM_SIZE; i++) {
+		frame[frameOffset(position) + i] = datagram[i];
+	}
+
+	transferFrame(frame);
+
+	for (size_t i = 0; i < MCL_DATAGRAM_SIZE; i++) {
+		datagram[i] = frame[frameOffset(position) + i];
+	}
+	return true;
+}
+
+void Thorlabs_TMC5130_chain::transferFrame(uint8_t* frame)
+{
+	Thorlabs_SPI_transfer(frame, (size_t)_length * MCL_DATAGRAM_SIZE);
+
+	for (uint8_t p = 0; p < _length; p++) {
+		_status[p] = frame[frameOffset(p)];
+	}
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------- Chain axis adapter --------------------------
+//-----------------------------------------------------------------------
+
+Thorlabs_TMC5130_chain_axis::Thorlabs_TMC5130_chain_axis(Thorlabs_TMC5130_chain* chain, uint8_t position)
+{
+	//No frame has room for a position past MCL_CHAIN_MAX, so don't attach to the chain at all
+	_chain = (position < MCL_CHAIN_MAX) ? chain : NULL;
+	_position = position;
+}
+
+void Thorlabs_TMC5130_chain_axis::Thorlabs_SPI_transfer(void *buf, size_t count) {
+	//Callers hand us one datagram at a time, the chain checks the position against its length
+	if (_chain && count == MCL_DATAGRAM_SIZE) {
+		_chain->transfer_single(_position, (uint8_t*)buf);
+		return;
+	}
+
+	//Detached, reply with nothing rather than our own bytes
+	uint8_t* bytes = (uint8_t*)buf;
+	for (size_t i = 0; i < count; i++) {
+		bytes[i] = 0;
+	}
+}
+
+void Thorlabs_TMC5130_chain_axis::Thorlabs_SPI_begin() {
+	if (_chain) {
+		_chain->begin_transaction();
+	}
+}
+
+void Thorlabs_TMC5130_chain_axis::Thorlabs_SPI_end() {
+	if (_chain) {
+		_chain->end_transaction();
+	}
+}
+
+
+//-----------------------------------------------------------------------
+//------------------- To be implemented by user -------------------------
+//-----------------------(Platform Specific)-----------------------------
+//-----------------------------------------------------------------------
+
+void Thorlabs_TMC5130_chain::Thorlabs_SPI_transfer(void *buf, size_t count) {
+	//Implement this in a parent class or modify for your platform
+
+	//Take in an array of single bytes (buf) of size (count), all within one CS assertion
+	//Replace the transmitted bytes with the received data
+}
+
+void Thorlabs_TMC5130_chain::Thorlabs_SPI_begin() {
+	//Implement this in a parent class or modify for your platform
+
+	//Used if your platform has an SPI transaction begin function (i.e. Arduino)
+}
+
+void Thorlabs_TMC5130_chain::Thorlabs_SPI_end() {
+	//Implement this in a parent class or modify for your platform
+
+	//Used if your platform has an SPI transaction end function (i.e. Arduino)
+}
+
+void Thorlabs_TMC5130_chain::Thorlabs_SPI_setup() {
+	//Implement this in a parent class or modify for your platform
+
+	//Platform specific startup code, i.e. pin assignments / SPI initialization
+}
@@ -0,0 +1,35 @@
+/*
+ * TMC5130_core.cpp
+ *
+ *  Register state shared by the TMC5130 front ends
+ */
+
+#include "TMC5130_lib.h"
+
+Thorlabs_TMC5130_state::Thorlabs_TMC5130_state()
+{
+	_shadow = NULL;
+	_suppressWrites = false;
+	_suppressedWrites = 0;
+	_issuedWrites = 0;
+	_status = 0;
+	_statusFresh = false;
+}
+
+void Thorlabs_TMC5130_state::enableShadowRegisters(shadowRegisters* storage)
+{
+	_shadow = storage;
+
+	//Start from a clean slate, nothing is known about the chip yet
+	if (_shadow) {
+		for (size_t i = 0; i < MCL_REGISTER_COUNT / 32; i++) {
+			_shadow->valid[i] = 0;
+		}
+	}
+}
+
+void Thorlabs_TMC5130_state::resetWriteCounters()
+{
+	_suppressedWrites = 0;
+	_issuedWrites = 0;
+}
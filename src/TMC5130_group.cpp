@@ -0,0 +1,292 @@
+/*
+ * TMC5130_group.cpp
+ *
+ *  Coordinated multi-axis moves with synchronized arrival
+ */
+
+#include "TMC5130_group.h"
+
+//Ramp registers an axis's profile covers, in profile order
+static const uint8_t profileAddrs[MCL_GROUP_PROFILE_REGS] = {
+	MCL_A1, MCL_V1, MCL_AMAX, MCL_VMAX, MCL_DMAX, MCL_D1, MCL_VSTOP
+};
+
+static void profileValues(const Thorlabs_TMC5130_motion::profile& p, uint32_t* out)
+{
+	out[0] = p.A1;
+	out[1] = p.V1;
+	out[2] = p.AMAX;
+	out[3] = p.VMAX;
+	out[4] = p.DMAX;
+	out[5] = p.D1;
+	out[6] = p.VSTOP;
+}
+
+static void profileFromValues(const uint32_t* in, Thorlabs_TMC5130_motion::profile* p)
+{
+	p->VSTART = 0;
+	p->A1 = in[0];
+	p->V1 = in[1];
+	p->AMAX = in[2];
+	p->VMAX = in[3];
+	p->DMAX = in[4];
+	p->D1 = in[5];
+	p->VSTOP = in[6];
+}
+
+//Registers that must not end up 0 after scaling (V1 = 0 is valid, it disables A1/D1)
+static bool needsNonZero(uint8_t addr)
+{
+	return addr != MCL_V1;
+}
+
+
+Thorlabs_TMC5130_group::Thorlabs_TMC5130_group()
+{
+	_count = 0;
+}
+
+int8_t Thorlabs_TMC5130_group::addAxis(Thorlabs_TMC5130* drv)
+{
+	if (_count == MCL_GROUP_MAX) {
+		return -1;
+	}
+
+	axisEntry& a = _axes[_count];
+	a.drv = drv;
+	a.chain = NULL;
+	a.position = 0;
+	a.limits = Thorlabs_TMC5130_motion::fromDriver(*drv);
+	a.profile = a.limits;
+	profileValues(a.limits, a.written);
+	return _count++;
+}
+
+int8_t Thorlabs_TMC5130_group::addAxis(Thorlabs_TMC5130_chain_axis* axis)
+{
+	//A detached axis, or one past the end of its chain, has no slot in a chain frame
+	if (!axis->chain() || axis->position() >= axis->chain()->length()) {
+		return -1;
+	}
+
+	int8_t index = addAxis((Thorlabs_TMC5130*)axis);
+	if (index >= 0) {
+		_axes[index].chain = axis->chain();
+		_axes[index].position = axis->position();
+	}
+	return index;
+}
+
+void Thorlabs_TMC5130_group::readAll(uint8_t addr, int32_t* out)
+{
+	bool done[MCL_GROUP_MAX] = {false};
+
+	for (uint8_t i = 0; i < _count; i++) {
+		if (done[i]) {
+			continue;
+		}
+
+		if (!_axes[i].chain) {
+			_axes[i].drv->read_register(addr, &out[i]);
+			done[i] = true;
+			continue;
+		}
+
+		//Two frames answer for the whole chain. Positions outside the group get a GCONF read,
+		//so registers that clear on read (RAMP_STAT) are only touched on our own axes.
+		Thorlabs_TMC5130_chain* chain = _axes[i].chain;
+		uint8_t addrs[MCL_CHAIN_MAX];
+		int32_t replies[MCL_CHAIN_MAX];
+		for (uint8_t p = 0; p < MCL_CHAIN_MAX; p++) {
+			addrs[p] = MCL_GCONF;
+		}
+		for (uint8_t j = i; j < _count; j++) {
+			if (_axes[j].chain == chain) {
+				addrs[_axes[j].position] = addr;
+			}
+		}
+		chain->read_frame(addrs, replies);
+		for (uint8_t j = i; j < _count; j++) {
+			if (_axes[j].chain == chain) {
+				out[j] = replies[_axes[j].position];
+				done[j] = true;
+			}
+		}
+	}
+}
+
+void Thorlabs_TMC5130_group::getPositions(int32_t* out)
+{
+	readAll(MCL_XACTUAL, out);
+}
+
+bool Thorlabs_TMC5130_group::isAtTarget()
+{
+	int32_t status[MCL_GROUP_MAX];
+
+	readAll(MCL_RAMP_STAT, status);
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!(status[i] & MCL_RAMP_POSITION_REACHED)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+float Thorlabs_TMC5130_group::moveTo(const int32_t* targets)
+{
+	int32_t starts[MCL_GROUP_MAX];
+
+	getPositions(starts);
+	return moveTo(starts, targets);
+}
+
+float Thorlabs_TMC5130_group::moveTo(const int32_t* starts, const int32_t* targets)
+{
+	double distance[MCL_GROUP_MAX];
+	double longest = 0;
+	bool move[MCL_GROUP_MAX];
+
+	for (uint8_t i = 0; i < _count; i++) {
+		distance[i] = fabs((double)targets[i] - (double)starts[i]);
+		move[i] = (distance[i] > 0);
+		if (distance[i] > longest) {
+			longest = distance[i];
+		}
+	}
+
+	if (longest == 0) {
+		return 0;
+	}
+
+	//Path profile, in units of the longest axis. Axis i runs it scaled by distance[i] / longest,
+	//so the path can go no faster than limit / scale on any axis.
+	double path[MCL_GROUP_PROFILE_REGS];
+	for (size_t r = 0; r < MCL_GROUP_PROFILE_REGS; r++) {
+		path[r] = -1;
+	}
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!move[i]) {
+			continue;
+		}
+
+		uint32_t limits[MCL_GROUP_PROFILE_REGS];
+		profileValues(_axes[i].limits, limits);
+		double scale = distance[i] / longest;
+		for (size_t r = 0; r < MCL_GROUP_PROFILE_REGS; r++) {
+			double v = limits[r] / scale;
+			if (path[r] < 0 || v < path[r]) {
+				path[r] = v;
+			}
+		}
+	}
+
+	//Scale the path down to each axis. Rounding down keeps every axis within its limits,
+	//the small bias stops exact fits from dropping a count.
+	for (uint8_t i = 0; i < _count; i++) {
+		if (!move[i]) {
+			continue;
+		}
+
+		uint32_t values[MCL_GROUP_PROFILE_REGS];
+		double scale = distance[i] / longest;
+		for (size_t r = 0; r < MCL_GROUP_PROFILE_REGS; r++) {
+			values[r] = (uint32_t)floor(path[r] * scale + 1e-6);
+			if (values[r] == 0 && needsNonZero(profileAddrs[r])) {
+				values[r] = 1;
+			}
+		}
+
+		Thorlabs_TMC5130_motion::profile profile;
+		profileFromValues(values, &profile);
+		writeProfile(i, profile);
+	}
+
+	//All profiles are in place, now start everyone as close together as the buses allow
+	startAll(targets, move);
+
+	//Path profile over the longest distance is how long every axis takes
+	uint32_t values[MCL_GROUP_PROFILE_REGS];
+	for (size_t r = 0; r < MCL_GROUP_PROFILE_REGS; r++) {
+		values[r] = (uint32_t)floor(path[r] + 1e-6);
+	}
+	Thorlabs_TMC5130_motion::profile profile;
+	profileFromValues(values, &profile);
+	return Thorlabs_TMC5130_motion::estimate(profile, 0, (int32_t)longest).total;
+}
+
+void Thorlabs_TMC5130_group::writeProfile(uint8_t axis, const Thorlabs_TMC5130_motion::profile& profile)
+{
+	axisEntry& a = _axes[axis];
+	uint32_t before[MCL_GROUP_PROFILE_REGS];
+	uint32_t after[MCL_GROUP_PROFILE_REGS];
+	uint8_t addrs[MCL_GROUP_PROFILE_REGS];
+	uint32_t data[MCL_GROUP_PROFILE_REGS];
+	size_t n = 0;
+
+	//What the chip holds: the driver's shadow where it has it, otherwise our last write.
+	//A reset loses both, everything goes out until the reset flag has been cleared.
+	bool reset = (a.drv->getLastStatus() & MCL_STATUS_RESET_FLAG) != 0;
+	profileValues(profile, after);
+	for (size_t r = 0; r < MCL_GROUP_PROFILE_REGS; r++) {
+		if (!a.drv->getShadowRegister(profileAddrs[r], &before[r])) {
+			before[r] = a.written[r];
+		}
+		if (reset || after[r] != before[r]) {
+			addrs[n] = profileAddrs[r];
+			data[n++] = after[r];
+		}
+	}
+	if (n > 0) {
+		a.drv->write_registers(addrs, data, n);
+	}
+
+	for (size_t r = 0; r < MCL_GROUP_PROFILE_REGS; r++) {
+		a.written[r] = after[r];
+	}
+	a.profile = profile;
+	a.drv->A1 = profile.A1;
+	a.drv->V1 = profile.V1;
+	a.drv->AMAX = profile.AMAX;
+	a.drv->VMAX = profile.VMAX;
+	a.drv->DMAX = profile.DMAX;
+	a.drv->D1 = profile.D1;
+	a.drv->VSTOP = profile.VSTOP;
+}
+
+void Thorlabs_TMC5130_group::startAll(const int32_t* targets, const bool* move)
+{
+	bool done[MCL_GROUP_MAX] = {false};
+
+	for (uint8_t i = 0; i < _count; i++) {
+		if (done[i] || !move[i]) {
+			continue;
+		}
+
+		if (!_axes[i].chain) {
+			_axes[i].drv->moveTo(targets[i]);
+			done[i] = true;
+			continue;
+		}
+
+		//One frame for the whole chain, positions outside the group get a harmless GCONF read
+		Thorlabs_TMC5130_chain* chain = _axes[i].chain;
+		uint8_t addrs[MCL_CHAIN_MAX] = {0};
+		uint32_t data[MCL_CHAIN_MAX] = {0};
+		for (uint8_t j = i; j < _count; j++) {
+			if (_axes[j].chain == chain && move[j]) {
+				addrs[_axes[j].position] = MCL_XTARGET | MCL_WRITE_BIT;
+				data[_axes[j].position] = targets[j];
+				done[j] = true;
+			}
+		}
+		chain->transfer_frame(addrs, data, NULL);
+
+		//Keep the axes' shadows in step with the frame they didn't see
+		for (uint8_t j = i; j < _count; j++) {
+			if (_axes[j].chain == chain && move[j]) {
+				_axes[j].drv->recordWrite(MCL_XTARGET, targets[j]);
+			}
+		}
+	}
+}
@@ -0,0 +1,102 @@
+/*
+ * TMC5130_histogram.cpp
+ *
+ *  Log-linear latency histogram
+ */
+
+#include "TMC5130_histogram.h"
+
+//Values below this are exact
+#define MCL_LATENCY_LINEAR  (2UL << MCL_LATENCY_BITS)
+
+//Position of the highest set bit, value must not be 0
+static inline uint8_t msb(uint32_t value)
+{
+#if defined(__GNUC__)
+	return 31 - __builtin_clz(value);
+#else
+	uint8_t bit = 0;
+	while (value >>= 1) {
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+
+Thorlabs_TMC5130_histogram::Thorlabs_TMC5130_histogram()
+{
+	reset();
+}
+
+void Thorlabs_TMC5130_histogram::reset()
+{
+	for (size_t i = 0; i < MCL_LATENCY_BUCKETS; i++) {
+		_buckets[i] = 0;
+	}
+	_count = 0;
+	_min = 0xFFFFFFFF;
+	_max = 0;
+	_sum = 0;
+}
+
+size_t Thorlabs_TMC5130_histogram::bucketIndex(uint32_t value)
+{
+	if (value < MCL_LATENCY_LINEAR) {
+		return value;
+	}
+
+	//Leading 1 plus the next MCL_LATENCY_BITS bits pick the bucket within the octave
+	uint8_t shift = msb(value) - MCL_LATENCY_BITS;
+	return ((size_t)shift << MCL_LATENCY_BITS) + (value >> shift);
+}
+
+uint32_t Thorlabs_TMC5130_histogram::bucketTop(size_t index)
+{
+	if (index < MCL_LATENCY_LINEAR) {
+		return index;
+	}
+
+	uint8_t shift = (index >> MCL_LATENCY_BITS) - 1;
+	uint64_t mantissa = (index & ((1UL << MCL_LATENCY_BITS) - 1)) | (1UL << MCL_LATENCY_BITS);
+	return (uint32_t)(((mantissa + 1) << shift) - 1);
+}
+
+void Thorlabs_TMC5130_histogram::record(uint32_t value)
+{
+	_buckets[bucketIndex(value)]++;
+	_count++;
+	_sum += value;
+	if (value < _min) {
+		_min = value;
+	}
+	if (value > _max) {
+		_max = value;
+	}
+}
+
+uint32_t Thorlabs_TMC5130_histogram::percentile(float fraction)
+{
+	if (_count == 0) {
+		return 0;
+	}
+
+	//Rank of the sample we're after, 1 based
+	uint32_t rank = (uint32_t)(fraction * _count + 0.5f);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > _count) {
+		rank = _count;
+	}
+
+	uint32_t seen = 0;
+	for (size_t i = 0; i < MCL_LATENCY_BUCKETS; i++) {
+		seen += _buckets[i];
+		if (seen >= rank) {
+			uint32_t top = bucketTop(i);
+			return (top < _max) ? top : _max;
+		}
+	}
+	return _max;
+}
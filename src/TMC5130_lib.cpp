@@ -7,249 +7,303 @@
 
 #include "TMC5130_lib.h"
 
-void Thorlabs_TMC5130::begin(int8_t CS_pin)
-{
-	_cs = CS_pin;
+//Transfers are only timestamped when something compiled in uses the time
+#if defined(MCL_ENABLE_STATS) || defined(MCL_ENABLE_TRACE) || defined(MCL_ENABLE_TIMELINE)
+#define MCL_TIMED_TRANSFERS
+#endif
 
-	//Default parameters that work with most stepper setups
-	A1 = 0x000088B8;    // (35,000)
-	V1 = 0x00004E20;    // (20,000)
-	AMAX = 0x00002710;  // (10,000)
-	VMAX = 0x00030D40;  // (200,000)
-	DMAX = 0x00003A98;  // (15,000)
-	D1 = 0x0000C350;    // (50,000)
-	VSTOP = 0x0000000A; // (10)
+//Register access and driver API for this front end, compiled once here
+template class Thorlabs_TMC5130_core<Thorlabs_TMC5130>;
 
-	Thorlabs_SPI_setup();
-
-	updateMotionProfile();
-	basicMotorConfig();
+Thorlabs_TMC5130::Thorlabs_TMC5130()
+{
+	_cs = -1;
+#ifdef MCL_ENABLE_TRACE
+	_trace = NULL;
+	_traceId = 0;
+#endif
+#ifdef MCL_ENABLE_TIMELINE
+	_timeline = NULL;
+	_timelineId = 0;
+	_timelineBus = 0;
+#endif
+#ifdef MCL_ENABLE_STATS
+	resetAccessStats();
+#endif
 }
 
-void Thorlabs_TMC5130::write_register(uint8_t addr, uint32_t data)
+void Thorlabs_TMC5130::begin(int8_t CS_pin)
 {
-	const int cmd_size = 5;
-	uint8_t cmd[cmd_size];
-	//build command word
-	cmd[0] = addr^0x80; //  bitwise XOR to set the write bit
-	cmd[1] = (data >> 24) & 0xFF; //  rest of command
-	cmd[2] = (data >> 16) & 0xFF;
-	cmd[3] = (data >> 8) & 0xFF;
-	cmd[4] = data & 0xFF;
-	
-	//Begin Transaction
-	Thorlabs_SPI_begin();
-
-	Thorlabs_SPI_transfer(cmd, cmd_size);
+	_cs = CS_pin;
 
-	Thorlabs_SPI_end();
+	//Defaults, basic config and the GSTAT read are the same for every front end
+	Thorlabs_TMC5130_core<Thorlabs_TMC5130>::begin();
 }
 
-uint8_t Thorlabs_TMC5130::read_register(uint8_t addr, int32_t* out)
+void Thorlabs_TMC5130::transferDatagrams(uint8_t *buf, size_t datagrams)
 {
-	const int buf_size = 5;
-	uint8_t cmd[buf_size];
-	uint8_t _dummy_cmd[buf_size];
-
-	//build command word. Rest of cmd word [1-4] is all 0
-	cmd[0] = addr^0x00; // bitwise XOR to set the read byte
-	
-	for (int i = 0; i < buf_size; i++) {
-		_dummy_cmd[i] = cmd[i];
+#ifdef MCL_ENABLE_STATS
+	countDatagrams(buf, datagrams);
+#endif
+
+#ifdef MCL_TIMED_TRANSFERS
+	//Only ask the platform for the time when someone is listening
+	bool timed = false;
+#ifdef MCL_ENABLE_STATS
+	timed = true;
+#endif
+#ifdef MCL_ENABLE_TRACE
+	timed = timed || _trace;
+#endif
+#ifdef MCL_ENABLE_TIMELINE
+	timed = timed || _timeline;
+	bool write = buf[0] & MCL_WRITE_BIT;	// buf holds the replies after the transfer
+#endif
+	uint32_t start = timed ? Thorlabs_get_time_ns() : 0;
+#endif
+
+#ifdef MCL_ENABLE_TRACE
+	uint32_t slot = 0;
+	if (_trace) {
+		slot = _trace->submit(buf, datagrams, start, _traceId, 0);
 	}
-	
-	//Begin Transaction
-	Thorlabs_SPI_begin();
-
-	Thorlabs_SPI_transfer(_dummy_cmd, buf_size);
+#endif
 
-	Thorlabs_SPI_transfer(cmd, buf_size);
-	
-	Thorlabs_SPI_end();
-
-	uint8_t _status = cmd[0];
-	int32_t _out = ((int32_t) cmd[1]) << 24; // put the MSB in place
-	_out |= ((int32_t) cmd[2]) << 16; // add next byte
-	_out |= ((int32_t) cmd[3]) << 8; // add next byte
-	_out |= ((int32_t) cmd[4]); // add LSB
+	Thorlabs_SPI_transfer_datagrams(buf, datagrams);
 
-	*out = _out;
+#ifdef MCL_ENABLE_TRACE
+	if (_trace) {
+		_trace->complete(slot, buf, datagrams);
+	}
+#endif
+
+#if defined(MCL_ENABLE_STATS) || defined(MCL_ENABLE_TIMELINE)
+	if (timed) {
+		uint32_t end = Thorlabs_get_time_ns();
+#ifdef MCL_ENABLE_STATS
+		_accessStats.transfer_ns += (uint32_t)(end - start);
+#endif
+#ifdef MCL_ENABLE_TIMELINE
+		if (_timeline) {
+			_timeline->add(MCL_TIMELINE_SPI, write ? "write" : "read",
+				_timelineId, _timelineBus, start, end, datagrams);
+		}
+#endif
+	}
+#endif
 
-	return _status;
+	//Every reply starts with SPI_STATUS, the last one is the most recent
+	captureStatus(buf[(datagrams - 1) * MCL_DATAGRAM_SIZE]);
 }
 
-void Thorlabs_TMC5130::jog(int32_t uSteps)
+void Thorlabs_TMC5130::captureStatus(uint8_t status)
 {
-	int32_t buf;
-	int32_t target;
-
-	read_register(MCL_XACTUAL, &buf);
-	target = buf + uSteps;
-	write_register(MCL_XTARGET, target);
+	Thorlabs_TMC5130_state::captureStatus(status);
+
+#ifdef MCL_ENABLE_TIMELINE
+	//Phase as far as the status flags can tell, nothing once arrived or stopped
+	if (_timeline) {
+		const char* phase = "ramping";
+		if (status & (MCL_STATUS_POSITION_REACHED | MCL_STATUS_STANDSTILL)) {
+			phase = NULL;
+		}
+		else if (status & MCL_STATUS_VELOCITY_REACHED) {
+			phase = "at VMAX";
+		}
+		timelinePhase(MCL_TIMELINE_STATUS, phase, Thorlabs_get_time_ns());
+	}
+#endif
 }
 
-void Thorlabs_TMC5130::moveTo(int32_t pos)
+void Thorlabs_TMC5130::write_register_async(uint8_t addr, uint32_t data, asyncTransfer* xfer, asyncCallback callback, void* context)
 {
-	write_register(MCL_XTARGET, pos);
+	xfer->datagrams = 1;
+	xfer->addr = addr & 0x7F;
+	xfer->data = data;
+	xfer->out = NULL;
+	xfer->callback = callback;
+	xfer->context = context;
+	xfer->complete = false;
+
+	//Value is already in the chip, complete without touching the bus
+	if (isRedundantWrite(addr, data)) {
+		_suppressedWrites++;
+		xfer->status = _status;
+		xfer->complete = true;
+		if (callback) {
+			callback(context);
+		}
+		return;
+	}
+
+	Thorlabs_TMC5130_datagram::encodeWrite(xfer->buf, addr, data);
+	_issuedWrites++;
+
+#ifdef MCL_ENABLE_STATS
+	countDatagrams(xfer->buf, xfer->datagrams);
+#endif
+	Thorlabs_SPI_transfer_async(xfer);
 }
 
-bool Thorlabs_TMC5130::isStopped()
+void Thorlabs_TMC5130::read_register_async(uint8_t addr, int32_t* out, asyncTransfer* xfer, asyncCallback callback, void* context)
 {
-	int32_t buf;
-	read_register(MCL_VACTUAL, &buf);
-	if ((int)buf == 0) {
-		return true;
-	}
-	else {
-		return false;
-	}
+	xfer->datagrams = 2;
+	xfer->addr = addr & 0x7F;
+	xfer->data = 0;
+	xfer->out = out;
+	xfer->callback = callback;
+	xfer->context = context;
+	xfer->complete = false;
+
+	//Request, then repeat it to clock out the reply
+	Thorlabs_TMC5130_datagram::encodeRead(&xfer->buf[0], addr);
+	Thorlabs_TMC5130_datagram::encodeRead(&xfer->buf[MCL_DATAGRAM_SIZE], addr);
+
+#ifdef MCL_ENABLE_STATS
+	countDatagrams(xfer->buf, xfer->datagrams);
+#endif
+	Thorlabs_SPI_transfer_async(xfer);
 }
 
-void Thorlabs_TMC5130::setRampMode(rampMode mode)
+void Thorlabs_TMC5130::getPosition_async(int32_t* out, asyncTransfer* xfer, asyncCallback callback, void* context)
 {
-	write_register(MCL_RAMPMODE, mode);
+	read_register_async(MCL_XACTUAL, out, xfer, callback, context);
 }
 
-void Thorlabs_TMC5130::setVelocity(int32_t velocity)
-{	VMAX = velocity;
-	write_register(MCL_VMAX, VMAX);
+void Thorlabs_TMC5130::moveTo_async(int32_t pos, asyncTransfer* xfer, asyncCallback callback, void* context)
+{
+	write_register_async(MCL_XTARGET, pos, xfer, callback, context);
 }
 
-void Thorlabs_TMC5130::enableStealthChop(bool enabled)
+#ifdef MCL_ENABLE_STATS
+void Thorlabs_TMC5130::resetAccessStats()
 {
-	int32_t currentConfig;
-	int32_t newConfig;
-	int32_t configMask;
-
-	int8_t en_pwm_mode_reg_offset = 2;
-
-	read_register(MCL_GCONF, &currentConfig);
-
-	//Make mask to select en_pwm_mode bit
-	configMask = ~(1 << en_pwm_mode_reg_offset);
-
-	//Reset en_pwm_mode bit from current config
-	newConfig = currentConfig & configMask;
-
-	//Set en_pwm_mode bit to our selection
-	newConfig |= (enabled << en_pwm_mode_reg_offset);
-
-	write_register(MCL_GCONF, newConfig);
+	for (size_t i = 0; i < MCL_REGISTER_COUNT; i++) {
+		_accessStats.reads[i] = 0;
+		_accessStats.writes[i] = 0;
+	}
+	_accessStats.transfers = 0;
+	_accessStats.transfer_ns = 0;
 }
 
-void Thorlabs_TMC5130::reverseDirection(bool enabled)
+void Thorlabs_TMC5130::countDatagrams(const uint8_t* buf, size_t datagrams)
 {
-	int32_t currentConfig;
-	int32_t newConfig;
-	int32_t configMask;
-
-	int8_t shaft_reg_offset = 4;
-
-	read_register(MCL_GCONF, &currentConfig);
-
-	//Make mask to select bit
-	configMask = ~(1 << shaft_reg_offset);
-
-	//Reset bit from current config
-	newConfig = currentConfig & configMask;
-
-	//Set bit to our selection
-	newConfig |= (enabled << shaft_reg_offset);
-
-	write_register(MCL_GCONF, newConfig);
+	for (size_t i = 0; i < datagrams; i++) {
+		uint8_t addr = buf[i * MCL_DATAGRAM_SIZE];
+		if (addr & MCL_WRITE_BIT) {
+			_accessStats.writes[addr & ~MCL_WRITE_BIT]++;
+		}
+		else {
+			_accessStats.reads[addr]++;
+		}
+	}
+	_accessStats.transfers++;
 }
+#endif
 
-void Thorlabs_TMC5130::setPosition(int32_t pos)
+#ifdef MCL_ENABLE_LATENCY
+void Thorlabs_TMC5130::resetLatency()
 {
-	write_register(MCL_XACTUAL, pos);
+	for (size_t i = 0; i < latencyOpCount; i++) {
+		_latency[i].reset();
+	}
 }
+#endif
 
-int32_t Thorlabs_TMC5130::getPosition()
+#if defined(MCL_ENABLE_LATENCY) || defined(MCL_ENABLE_TIMELINE)
+Thorlabs_TMC5130::callScope::callScope(Thorlabs_TMC5130* drv, const char* name, latencyOp op)
 {
-	int32_t pos;
-	read_register(MCL_XACTUAL, &pos);
-	return pos;
+	_drv = drv;
+	_name = name;
+	_op = op;
+
+	//Only ask the platform for the time when something records it
+	_timed = false;
+#ifdef MCL_ENABLE_LATENCY
+	_timed = (op < latencyOpCount);
+#endif
+#ifdef MCL_ENABLE_TIMELINE
+	_timed = _timed || drv->_timeline;
+#endif
+	_start = _timed ? drv->Thorlabs_get_time_ns() : 0;
 }
 
-void Thorlabs_TMC5130::setCurrentLimits(float iHoldCurrent, float iRunCurrent, int8_t iHoldDelay)
+Thorlabs_TMC5130::callScope::~callScope()
 {
-	float VfsVoltage;
-	bool VfsBit;
-	float Rsense = 0.15;
-	int8_t iHold, iRun;
-
-	//If above 750mA, use Vsense scaling of 0.32V. Otherwise use scaling of 0.18V.
-	VfsVoltage = (iHoldCurrent > 0.75 || iRunCurrent > 0.75) ? 0.32 : 0.18;
-
-	//Same as above, but getting the actual register value to write
-	VfsBit = !(iHoldCurrent > 0.75 || iRunCurrent > 0.75);
-
-	//Calculate 5 bit scalar values for iHold and iRun from motor current
-	//Equation is rearranged from section 10 of TMC5130 datasheet
-	iHold = abs(((32 * sqrt(2) * iHoldCurrent * (Rsense + 0.02)) / VfsVoltage) - 1);
-	iRun = abs(((32 * sqrt(2) * iRunCurrent * (Rsense + 0.02)) / VfsVoltage) - 1);
-
-	//Format and write to IHOLD_IRUN register
-	int32_t IHOLD_IRUN_CONFIG = 0;
-	IHOLD_IRUN_CONFIG |= ((iHoldDelay & 0xF) << 16);
-	IHOLD_IRUN_CONFIG |= ((iRun & 0x1F) << 8);
-	IHOLD_IRUN_CONFIG |= (iHold & 0x1F);
-
-	//Write newly formatted IHOLD_IRUN register
-	write_register(MCL_IHOLD_IRUN, IHOLD_IRUN_CONFIG);
-
-	//Format and write to CHOPCONF register based on our Vfs selection
-	int32_t currentChopconf;
-	int32_t newChopconf;
-	int32_t configMask;
-	int8_t vsense_reg_offset = 17;
-
-	//Read current settings so we don't overwrite anything else
-	read_register(MCL_CHOPCONF, &currentChopconf);
-
-	//get bitmask for our specific register
-	configMask = ~(1 << vsense_reg_offset);
-
-	//Reset the bit that we want to modify
-	newChopconf = currentChopconf & configMask;
-
-	//Set the bit to the value we want
-	newChopconf |= (VfsBit << vsense_reg_offset);
+	if (!_timed) {
+		return;
+	}
 
-	//Write newly formatted settings to register
-	write_register(MCL_CHOPCONF, newChopconf);
+	uint32_t end = _drv->Thorlabs_get_time_ns();
+#ifdef MCL_ENABLE_LATENCY
+	if (_op < latencyOpCount) {
+		_drv->_latency[_op].record(end - _start);
+	}
+#endif
+#ifdef MCL_ENABLE_TIMELINE
+	if (_drv->_timeline) {
+		_drv->_timeline->add(MCL_TIMELINE_API, _name, _drv->_timelineId, _drv->_timelineBus, _start, end);
+	}
+#endif
 }
+#endif
 
-void Thorlabs_TMC5130::updateMotionProfile()
+#ifdef MCL_ENABLE_TIMELINE
+void Thorlabs_TMC5130::attachTimeline(Thorlabs_TMC5130_timeline* timeline, uint8_t id, uint8_t bus)
 {
-	write_register(MCL_A1, A1); // write value 0x000003E8 = A1 to address 11 = 0x24(A1)
-	write_register(MCL_V1, V1); // write value 0x000088B8 = V1 to address 12 = 0x25(V1)
-	write_register(MCL_AMAX, AMAX); // write value 0x00002710 = AMAX to address 13 = 0x26(AMAX)
-	write_register(MCL_VMAX, VMAX); // write value 0x0000C350 = VMAX to address 14 = 0x27(VMAX)
-	write_register(MCL_DMAX, DMAX); // write value 0x00002710 = DMAX to address 15 = 0x28(DMAX)
-	write_register(MCL_D1, D1); // write value 0x000003E8 = D1 to address 16 = 0x2A(D1)
-	write_register(MCL_VSTOP, VSTOP); // write value 0x0000000A = 10 = 10.0 to address 17 = 0x2B(VSTOP)
+	_timeline = timeline;
+	_timelineId = id;
+	_timelineBus = bus;
 }
 
-int32_t Thorlabs_TMC5130::getEncoderPosition() 
+void Thorlabs_TMC5130::timelinePhase(uint8_t kind, const char* name, uint32_t time_ns)
 {
-	int32_t pos;
-	read_register(MCL_X_ENC, &pos);
-	return pos;
+	if (_timeline) {
+		_timeline->phase(kind, name, _timelineId, time_ns);
+	}
 }
+#endif
 
-void Thorlabs_TMC5130::setEncoderPosition(int32_t pos)
+#ifdef MCL_ENABLE_TRACE
+void Thorlabs_TMC5130::attachTrace(Thorlabs_TMC5130_trace* trace, uint8_t id)
 {
-	write_register(MCL_X_ENC, pos);
+	_trace = trace;
+	_traceId = id;
 }
+#endif
 
-void Thorlabs_TMC5130::basicMotorConfig()
+void Thorlabs_TMC5130::completeAsync(asyncTransfer* xfer)
 {
-	//Setting CHOPCONF in here since general user doesn't need to tweak TOFF/HSTRT values
-	write_register(MCL_CHOPCONF, 0x000301D5);
+	uint8_t* reply = &xfer->buf[(xfer->datagrams - 1) * MCL_DATAGRAM_SIZE];
+
+	xfer->status = reply[0];
+	captureStatus(reply[0]);
+
+#ifdef MCL_ENABLE_TRACE
+	//Sent bytes have been replaced by now, rebuild them from the descriptor
+	if (_trace) {
+		uint8_t addr = xfer->out ? xfer->addr : (xfer->addr | MCL_WRITE_BIT);
+		uint32_t time = Thorlabs_get_time_ns();
+		for (size_t i = 0; i < xfer->datagrams; i++) {
+			_trace->log(addr, xfer->data, &xfer->buf[i * MCL_DATAGRAM_SIZE], time, _traceId,
+				(i == 0) ? (MCL_TRACE_ASYNC | MCL_TRACE_BATCH) : MCL_TRACE_ASYNC);
+		}
+	}
+#endif
+
+	if (xfer->out) {
+		*xfer->out = Thorlabs_TMC5130_datagram::decode(reply);
+		_statusFresh = true;
+	}
+	else {
+		_statusFresh = false;
+		updateShadow(&xfer->addr, &xfer->data, 1);
+	}
 
-	//Setting PWMCONF in here since user can get funky results if manually tweaking
-	write_register(MCL_PWMCONF, 0x000501C8);
+	xfer->complete = true;
+	if (xfer->callback) {
+		xfer->callback(xfer->context);
+	}
 }
 
 //TODO: add helper function to set encoder mode and scaling value
@@ -267,6 +321,28 @@ void Thorlabs_TMC5130::Thorlabs_SPI_transfer(void *buf, size_t count) {
 	//Replace the transmitted bytes with the received data
 }
 
+void Thorlabs_TMC5130::Thorlabs_SPI_transfer_datagrams(uint8_t *buf, size_t datagrams) {
+	//Override in a parent class if your platform can queue several datagrams at once
+
+	//Each datagram needs its own CS frame, so by default send them one at a time
+	for (size_t i = 0; i < datagrams; i++) {
+		Thorlabs_SPI_transfer(&buf[i * MCL_DATAGRAM_SIZE], MCL_DATAGRAM_SIZE);
+	}
+}
+
+void Thorlabs_TMC5130::Thorlabs_SPI_transfer_async(asyncTransfer* xfer) {
+	//Override in a parent class to start a DMA/interrupt driven transfer instead
+
+	//No async support by default, so run the transfer now and complete straight away
+	Thorlabs_SPI_begin();
+
+	Thorlabs_SPI_transfer_datagrams(xfer->buf, xfer->datagrams);
+
+	Thorlabs_SPI_end();
+
+	completeAsync(xfer);
+}
+
 void Thorlabs_TMC5130::Thorlabs_SPI_begin() {
 	//Implement this in a parent class or modify for your platform
 
@@ -284,3 +360,12 @@ void Thorlabs_TMC5130::Thorlabs_SPI_setup() {
 
 	//Platform specific startup code, i.e. pin assignments / SPI initialization
 }
+
+uint32_t Thorlabs_TMC5130::Thorlabs_get_time_ns() {
+	//Implement this in a parent class or modify for your platform
+
+	//Timestamps for the SPI trace, timeline, bus time stats and latency histograms
+	//(MCL_ENABLE_TRACE / TIMELINE / STATS / LATENCY), i.e. a cycle counter scaled to ns.
+	//Unused when none of them is enabled.
+	return 0;
+}
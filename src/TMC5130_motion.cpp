@@ -0,0 +1,135 @@
+/*
+ * TMC5130_motion.cpp
+ *
+ *  Closed form move timing from the ramp registers
+ */
+
+#include "TMC5130_motion.h"
+#include <cmath>
+
+//Distance covered changing speed from u0 up to u1 at rate a, 0 if there's nothing to change
+static inline float segmentDistance(float u0, float u1, float a)
+{
+	return (u1 > u0) ? (u1 * u1 - u0 * u0) / (2 * a) : 0;
+}
+
+static inline float segmentTime(float u0, float u1, float a)
+{
+	return (u1 > u0) ? (u1 - u0) / a : 0;
+}
+
+static inline float maxf(float a, float b) { return (a > b) ? a : b; }
+static inline float minf(float a, float b) { return (a < b) ? a : b; }
+
+//Ramp in physical units, A1/D1 below V1 and AMAX/DMAX above it
+typedef struct {
+	float vs, v1, ve;
+	float a1, amax, dmax, d1;
+} rampUnits;
+
+//Distance of a ramp peaking at v: up from VSTART, straight back down to VSTOP
+static float rampDistance(const rampUnits& r, float v)
+{
+	return segmentDistance(r.vs, minf(v, r.v1), r.a1) + segmentDistance(maxf(r.vs, r.v1), v, r.amax)
+		+ segmentDistance(r.ve, minf(v, r.v1), r.d1) + segmentDistance(maxf(r.ve, r.v1), v, r.dmax);
+}
+
+
+float Thorlabs_TMC5130_motion::velocity(uint32_t reg, uint32_t fclk)
+{
+	return (float)reg * ((float)fclk / 16777216.0f);
+}
+
+float Thorlabs_TMC5130_motion::acceleration(uint32_t reg, uint32_t fclk)
+{
+	//fCLK^2 / 2^41, split up to stay in float range
+	return (float)reg * ((float)fclk / 16777216.0f) * ((float)fclk / 131072.0f);
+}
+
+Thorlabs_TMC5130_motion::profile Thorlabs_TMC5130_motion::fromDriver(const Thorlabs_TMC5130_state& drv, uint32_t vstart)
+{
+	profile p;
+	p.VSTART = vstart;
+	p.A1 = drv.A1;
+	p.V1 = drv.V1;
+	p.AMAX = drv.AMAX;
+	p.VMAX = drv.VMAX;
+	p.DMAX = drv.DMAX;
+	p.D1 = drv.D1;
+	p.VSTOP = drv.VSTOP;
+	return p;
+}
+
+Thorlabs_TMC5130_motion::moveTime Thorlabs_TMC5130_motion::estimate(const profile& p, int32_t start, int32_t target, uint32_t fclk)
+{
+	moveTime t = {0, 0, 0, 0, 0, 0, 0};
+
+	float distance = (target > start) ? (float)((int64_t)target - start) : (float)((int64_t)start - target);
+	if (distance == 0) {
+		return t;
+	}
+
+	rampUnits r;
+	r.vs = velocity(p.VSTART, fclk);
+	r.ve = velocity(p.VSTOP, fclk);
+	r.amax = acceleration(p.AMAX, fclk);
+	r.dmax = acceleration(p.DMAX, fclk);
+
+	//V1 = 0 disables the A1/D1 phases, everything runs on AMAX/DMAX
+	r.v1 = 0;
+	r.a1 = r.amax;
+	r.d1 = r.dmax;
+	if (p.V1 > 0) {
+		r.v1 = velocity(p.V1, fclk);
+		r.a1 = acceleration(p.A1, fclk);
+		r.d1 = acceleration(p.D1, fclk);
+	}
+
+	//Peak can't be below where the ramp starts or stops
+	float vlo = maxf(r.vs, r.ve);
+	float vtop = maxf(velocity(p.VMAX, fclk), vlo);
+
+	//A ramp that has to change speed with a zero rate never gets there, and
+	//VMAX = 0 holds the motor whatever VSTART and VSTOP are
+	if (p.VMAX == 0 || (vtop > vlo && (r.amax <= 0 || r.dmax <= 0 || r.a1 <= 0 || r.d1 <= 0))) {
+		t.total = t.cruise = INFINITY;
+		return t;
+	}
+
+	float peak;
+	float full = rampDistance(r, vtop);
+	if (distance >= full) {
+		//Reaches VMAX and cruises for the rest
+		peak = vtop;
+		t.cruise = (vtop > 0) ? (distance - full) / vtop : 0;
+	}
+	else if (distance <= rampDistance(r, vlo)) {
+		//Too short to ramp at all, covered at the start/stop speed
+		t.peak = vlo;
+		t.cruise = t.total = distance / vlo;
+		return t;
+	}
+	else {
+		//Ramp distance is k * v^2 + c on either side of V1, so the peak solves directly
+		//from a known point on the right side
+		float ref = vlo;
+		if (r.v1 > vlo && r.v1 < vtop && distance > rampDistance(r, r.v1)) {
+			ref = r.v1;
+		}
+		bool upper = (ref >= r.v1);
+		float k = 1 / (2 * (upper ? r.amax : r.a1)) + 1 / (2 * (upper ? r.dmax : r.d1));
+
+		peak = sqrtf(ref * ref + (distance - rampDistance(r, ref)) / k);
+		if (peak > vtop) {
+			peak = vtop;
+		}
+	}
+
+	t.peak = peak;
+	t.a1 = segmentTime(r.vs, minf(peak, r.v1), r.a1);
+	t.amax = segmentTime(maxf(r.vs, r.v1), peak, r.amax);
+	t.dmax = segmentTime(maxf(r.ve, r.v1), peak, r.dmax);
+	t.d1 = segmentTime(r.ve, minf(peak, r.v1), r.d1);
+	t.total = t.a1 + t.amax + t.cruise + t.dmax + t.d1;
+	return t;
+}
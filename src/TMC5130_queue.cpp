@@ -0,0 +1,239 @@
+/*
+ * TMC5130_queue.cpp
+ *
+ *  Motion command queue, fed on position_reached
+ */
+
+#include "TMC5130_queue.h"
+#include <cmath>
+
+static_assert((MCL_QUEUE_DEPTH & (MCL_QUEUE_DEPTH - 1)) == 0, "MCL_QUEUE_DEPTH must be a power of 2");
+
+#define MCL_QUEUE_MASK      (MCL_QUEUE_DEPTH - 1)
+
+//Ramp registers in profile order, plus XTARGET at the end of the batch
+static const uint8_t profileAddrs[MCL_QUEUE_PROFILE_REGS] = {
+	MCL_VSTART, MCL_A1, MCL_V1, MCL_AMAX, MCL_VMAX, MCL_DMAX, MCL_D1, MCL_VSTOP
+};
+
+static void profileValues(const Thorlabs_TMC5130_motion::profile& p, uint32_t* out)
+{
+	out[0] = p.VSTART;
+	out[1] = p.A1;
+	out[2] = p.V1;
+	out[3] = p.AMAX;
+	out[4] = p.VMAX;
+	out[5] = p.DMAX;
+	out[6] = p.D1;
+	out[7] = p.VSTOP;
+}
+
+
+Thorlabs_TMC5130_queue::Thorlabs_TMC5130_queue(Thorlabs_TMC5130* drv)
+{
+	_drv = drv;
+	margin_us = 1000;
+	timeout_us = 100000;
+	fclk = MCL_FCLK;
+	_head = 0;
+	_tail = 0;
+	_vstart = 0;
+	profileValues(Thorlabs_TMC5130_motion::fromDriver(*drv, _vstart), _written);
+	_moving = false;
+	_positionValid = false;
+	_fault = false;
+	_faultStatus = 0;
+	_hasDeadline = false;
+	_watchStandstill = false;
+	_checkAt = 0;
+	_arriveAt = 0;
+	_deadline = 0;
+	_target = 0;
+	_position = 0;
+	_issued = 0;
+	_completed = 0;
+}
+
+bool Thorlabs_TMC5130_queue::push(const command& c)
+{
+	if (pending() == MCL_QUEUE_DEPTH) {
+		return false;
+	}
+	_commands[_head++ & MCL_QUEUE_MASK] = c;
+	return true;
+}
+
+bool Thorlabs_TMC5130_queue::moveTo(int32_t pos)
+{
+	command c;
+	c.type = MCL_QUEUE_MOVE;
+	c.value = pos;
+	return push(c);
+}
+
+bool Thorlabs_TMC5130_queue::setVelocity(uint32_t vmax)
+{
+	command c;
+	c.type = MCL_QUEUE_VELOCITY;
+	c.value = vmax;
+	return push(c);
+}
+
+bool Thorlabs_TMC5130_queue::setProfile(const Thorlabs_TMC5130_motion::profile& profile)
+{
+	command c;
+	c.type = MCL_QUEUE_PROFILE;
+	c.value = 0;
+	c.profile = profile;
+	return push(c);
+}
+
+void Thorlabs_TMC5130_queue::clear()
+{
+	_tail = _head;
+}
+
+void Thorlabs_TMC5130_queue::clearFault()
+{
+	//The motor stopped somewhere else, the next prediction starts from a fresh read
+	_fault = false;
+	_positionValid = false;
+}
+
+bool Thorlabs_TMC5130_queue::poll(uint32_t now_us)
+{
+	if (_fault) {
+		return false;
+	}
+
+	if (_moving) {
+		//Not due yet, no need to ask the chip
+		if ((int32_t)(now_us - _checkAt) < 0) {
+			return false;
+		}
+
+		//XACTUAL costs the same as RAMP_STAT and position_reached comes with it in SPI_STATUS
+		int32_t pos;
+		uint8_t status = _drv->read_register(MCL_XACTUAL, &pos);
+		_position = pos;
+
+		//A reset lost the target (a reset chip sits at XTARGET = 0 and reads as arrived), a driver
+		//error disabled the bridges. Standstill short of the target only counts once the move
+		//should be over, the motor sits still before its first step.
+		bool reached = (status & MCL_STATUS_POSITION_REACHED) != 0;
+		bool late = _watchStandstill && (int32_t)(now_us - _arriveAt) >= 0;
+		if ((status & (MCL_STATUS_RESET_FLAG | MCL_STATUS_DRIVER_ERROR)) ||
+			(!reached && late && (status & MCL_STATUS_STANDSTILL)) ||
+			(!reached && _hasDeadline && (int32_t)(now_us - _deadline) >= 0)) {
+			_moving = false;
+			_fault = true;
+			_faultStatus = status;
+			return false;
+		}
+		if (!reached) {
+			return false;
+		}
+		_moving = false;
+		_completed++;
+	}
+
+	if (pending() == 0) {
+		return false;
+	}
+
+	//The first move needs a starting point for its prediction
+	if (!_positionValid) {
+		_position = _drv->getPosition();
+		_positionValid = true;
+	}
+
+	return feed(now_us);
+}
+
+bool Thorlabs_TMC5130_queue::feed(uint32_t now_us)
+{
+	//What the chip holds: the driver's shadow where it has it, otherwise our last write
+	uint32_t before[MCL_QUEUE_PROFILE_REGS];
+	for (size_t i = 0; i < MCL_QUEUE_PROFILE_REGS; i++) {
+		if (!_drv->getShadowRegister(profileAddrs[i], &before[i])) {
+			before[i] = _written[i];
+		}
+	}
+
+	//Start from the driver's fields, so ones changed directly go out with this batch
+	Thorlabs_TMC5130_motion::profile next = Thorlabs_TMC5130_motion::fromDriver(*_drv, _vstart);
+
+	//Settings up to the next move are merged, only the final values go out
+	while (pending() > 0) {
+		const command& c = _commands[_tail & MCL_QUEUE_MASK];
+		if (c.type == MCL_QUEUE_MOVE) {
+			break;
+		}
+		if (c.type == MCL_QUEUE_VELOCITY) {
+			next.VMAX = c.value;
+		}
+		else {
+			next = c.profile;
+		}
+		_tail++;
+	}
+
+	uint8_t addrs[MCL_QUEUE_PROFILE_REGS + 1];
+	uint32_t data[MCL_QUEUE_PROFILE_REGS + 1];
+	uint32_t after[MCL_QUEUE_PROFILE_REGS];
+	size_t n = 0;
+
+	profileValues(next, after);
+	for (size_t i = 0; i < MCL_QUEUE_PROFILE_REGS; i++) {
+		if (after[i] != before[i]) {
+			addrs[n] = profileAddrs[i];
+			data[n++] = after[i];
+		}
+	}
+
+	bool move = (pending() > 0);
+	if (move) {
+		_target = _commands[_tail & MCL_QUEUE_MASK].value;
+		_tail++;
+		addrs[n] = MCL_XTARGET;
+		data[n++] = _target;
+	}
+
+	if (n == 0) {
+		return false;
+	}
+
+	//Profile changes and the target go out together
+	_drv->write_registers(addrs, data, n);
+
+	for (size_t i = 0; i < MCL_QUEUE_PROFILE_REGS; i++) {
+		_written[i] = after[i];
+	}
+
+	_vstart = next.VSTART;
+	_drv->A1 = next.A1;
+	_drv->V1 = next.V1;
+	_drv->AMAX = next.AMAX;
+	_drv->VMAX = next.VMAX;
+	_drv->DMAX = next.DMAX;
+	_drv->D1 = next.D1;
+	_drv->VSTOP = next.VSTOP;
+
+	if (move) {
+		//Stay off the bus until shortly before the predicted arrival. A profile that
+		//can't be predicted (or a very long move) is checked on every poll instead.
+		float total = Thorlabs_TMC5130_motion::estimate(next, _position, _target, fclk).total * 1e6f;
+		float us = total - margin_us;
+		_checkAt = now_us + ((us > 0 && us < 2e9f) ? (uint32_t)us : 0);
+		_hasDeadline = (total < 2e9f);
+		_arriveAt = now_us + (_hasDeadline ? (uint32_t)total : 0);
+		_deadline = _arriveAt + timeout_us;
+
+		//A profile that can't move never arrives, standstill is a fault from the first check on
+		_watchStandstill = _hasDeadline || std::isinf(total);
+		_moving = true;
+		_issued++;
+	}
+
+	return true;
+}
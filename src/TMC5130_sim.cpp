@@ -0,0 +1,865 @@
+/*
+ * TMC5130_sim.cpp
+ *
+ *  Software model of the TMC5130 register interface
+ */
+
+#include "TMC5130_sim.h"
+#include <cmath>
+
+//Power-on defaults that aren't zero
+#define MCL_SIM_IOIN_VERSION    0x11000000	// VERSION field of IOIN
+#define MCL_SIM_CHOPCONF_RESET  0x10410150
+#define MCL_SIM_PWMCONF_RESET   0x00050480
+
+//DRV_STATUS bits used by SPI_STATUS
+#define MCL_SIM_DRV_SG          0x01000000
+#define MCL_SIM_DRV_STST        0x80000000
+
+//SW_MODE bits
+#define MCL_SIM_SW_STOP_L_ENABLE 0x0001
+#define MCL_SIM_SW_STOP_R_ENABLE 0x0002
+
+//Standstill is flagged after 2^20 clocks without a step
+#define MCL_SIM_STST_CLOCKS     1048576.0
+
+//GSTAT bits
+#define MCL_SIM_GSTAT_RESET     0x01
+#define MCL_SIM_GSTAT_DRV_ERR   0x02
+
+//Default microstep table (MSLUT[0..7], MSLUTSEL, MSLUTSTART)
+static const uint32_t msLutReset[10] = {
+	0xAAAAB554, 0x4A9554AA, 0x24492929, 0x10104222,
+	0xFBFFFFFF, 0xB5BB777D, 0x49295556, 0x00404222,
+	0xFFFF8056, 0x00F70000
+};
+
+
+Thorlabs_TMC5130_model::Thorlabs_TMC5130_model()
+{
+	fclk = MCL_FCLK;
+	step_ns = 10000;
+	_phaseCallback = NULL;
+	_phaseContext = NULL;
+	reset();
+}
+
+void Thorlabs_TMC5130_model::reset()
+{
+	for (size_t i = 0; i < MCL_REGISTER_COUNT; i++) {
+		_regs[i] = 0;
+		reads[i] = 0;
+		writes[i] = 0;
+	}
+
+	_regs[MCL_GSTAT] = MCL_SIM_GSTAT_RESET;
+	_regs[MCL_IOIN] = MCL_SIM_IOIN_VERSION;
+	_regs[MCL_CHOPCONF] = MCL_SIM_CHOPCONF_RESET;
+	_regs[MCL_PWMCONF] = MCL_SIM_PWMCONF_RESET;
+	for (size_t i = 0; i < 10; i++) {
+		_regs[MCL_MS_LUT_0 + i] = msLutReset[i];
+	}
+
+	_latched = 0;
+	_timeNs = 0;
+	_position = 0;
+	_velocity = 0;
+	_zerowaitUntilNs = 0;
+	_lastStepNs = 0;
+	_phase = phaseStopped;
+	_reportedPhase = phaseStopped;
+	_brakeTarget = 0;
+	_stop_l = false;
+	_stop_r = false;
+}
+
+void Thorlabs_TMC5130_model::datagram(uint8_t* buf)
+{
+	uint8_t addr = buf[0] & ~MCL_WRITE_BIT;
+	uint32_t data = Thorlabs_TMC5130_datagram::decode(buf);
+
+	//Status and data go out while the new datagram shifts in
+	uint8_t status = spiStatus();
+	uint32_t reply = _latched;
+
+	if (buf[0] & MCL_WRITE_BIT) {
+		writes[addr]++;
+		writeRegister(addr, data);
+		reportPhase();
+	}
+	else {
+		//Data for this request goes out with the next datagram
+		reads[addr]++;
+		_latched = readRegister(addr);
+	}
+
+	Thorlabs_TMC5130_datagram::encode(buf, status, reply);
+}
+
+void Thorlabs_TMC5130_model::advanceTo(uint64_t now_ns)
+{
+	while (_timeNs < now_ns) {
+		//Nothing moves until the host writes something, skip straight ahead
+		if (isIdle()) {
+			_timeNs = now_ns;
+			break;
+		}
+
+		uint64_t dt = now_ns - _timeNs;
+		if (dt > step_ns) {
+			dt = step_ns;
+		}
+
+		_timeNs += dt;
+		step(dt * 1e-9);
+		reportPhase();
+	}
+
+	if (_phase == phaseZeroWait && _timeNs >= _zerowaitUntilNs) {
+		_phase = phaseStopped;
+	}
+	reportPhase();
+}
+
+void Thorlabs_TMC5130_model::reportPhase()
+{
+	if (_phase != _reportedPhase) {
+		_reportedPhase = _phase;
+		if (_phaseCallback) {
+			_phaseCallback(_phaseContext, _phase, _timeNs);
+		}
+	}
+}
+
+void Thorlabs_TMC5130_model::setPhaseCallback(phaseCallback callback, void* context)
+{
+	_phaseCallback = callback;
+	_phaseContext = context;
+}
+
+const char* Thorlabs_TMC5130_model::phaseName(rampPhase phase)
+{
+	switch (phase) {
+	case phaseStopped:	return "stopped";
+	case phaseA1:		return "A1";
+	case phaseAMAX:		return "AMAX";
+	case phaseCruise:	return "cruise";
+	case phaseDMAX:		return "DMAX";
+	case phaseD1:		return "D1";
+	case phaseZeroWait:	return "zerowait";
+	default:			return "?";
+	}
+}
+
+double Thorlabs_TMC5130_model::regVelocity(uint8_t addr)
+{
+	//v[Hz] = v[reg] * fCLK / 2^24
+	return (double)_regs[addr] * fclk / 16777216.0;
+}
+
+double Thorlabs_TMC5130_model::regAccel(uint8_t addr)
+{
+	//a[Hz/s] = a[reg] * fCLK^2 / 2^41
+	return (double)_regs[addr] * fclk * fclk / 2199023255552.0;
+}
+
+int32_t Thorlabs_TMC5130_model::vactual()
+{
+	return (int32_t)llround(_velocity * 16777216.0 / fclk);
+}
+
+double Thorlabs_TMC5130_model::brakingDistance(double speed)
+{
+	double v1 = regVelocity(MCL_V1);
+	double vstop = regVelocity(MCL_VSTOP);
+	double dmax = regAccel(MCL_DMAX);
+	double d1 = regAccel(MCL_D1);
+	double distance = 0;
+
+	if (speed <= vstop) {
+		return 0;
+	}
+
+	//V1 = 0 disables the A1/D1 phases
+	if (v1 == 0) {
+		d1 = dmax;
+		v1 = vstop;
+	}
+
+	if (speed > v1) {
+		distance += (dmax > 0) ? (speed * speed - v1 * v1) / (2 * dmax) : 0;
+		speed = v1;
+	}
+	distance += (d1 > 0) ? (speed * speed - vstop * vstop) / (2 * d1) : 0;
+
+	return distance;
+}
+
+bool Thorlabs_TMC5130_model::isIdle()
+{
+	if (_velocity != 0) {
+		return false;
+	}
+
+	switch (_regs[MCL_RAMPMODE] & 0x3) {
+	case Thorlabs_TMC5130::positionMode:
+		return _position == (double)(int32_t)_regs[MCL_XTARGET] && _timeNs >= _zerowaitUntilNs;
+	case Thorlabs_TMC5130::velocityModePos:
+	case Thorlabs_TMC5130::velocityModeNeg:
+		return _regs[MCL_VMAX] == 0;
+	default:
+		return true;
+	}
+}
+
+void Thorlabs_TMC5130_model::step(double dt)
+{
+	double vmax = regVelocity(MCL_VMAX);
+
+	//Where this step started, for a switch stop to take it back
+	double position = _position;
+	uint32_t xactual = _regs[MCL_XACTUAL];
+	uint32_t xenc = _regs[MCL_X_ENC];
+	uint64_t lastStep = _lastStepNs;
+
+	switch (_regs[MCL_RAMPMODE] & 0x3) {
+	case Thorlabs_TMC5130::positionMode:
+		stepPosition(dt);
+		break;
+	case Thorlabs_TMC5130::velocityModePos:
+		stepVelocity(dt, vmax);
+		break;
+	case Thorlabs_TMC5130::velocityModeNeg:
+		stepVelocity(dt, -vmax);
+		break;
+	default:
+		//Hold mode keeps the current velocity
+		move(_velocity * dt);
+		break;
+	}
+
+	//Enabled reference switches hard stop motion towards them. The step is taken back, so a
+	//motor held by a switch doesn't creep along one integration step at a time.
+	uint32_t sw = _regs[MCL_SW_MODE];
+	bool stop_l = _velocity < 0 && _stop_l && (sw & MCL_SIM_SW_STOP_L_ENABLE);
+	bool stop_r = _velocity > 0 && _stop_r && (sw & MCL_SIM_SW_STOP_R_ENABLE);
+	if (stop_l || stop_r) {
+		_position = position;
+		_regs[MCL_XACTUAL] = xactual;
+		_regs[MCL_X_ENC] = xenc;
+		_lastStepNs = lastStep;
+		_velocity = 0;
+		_phase = phaseStopped;
+		_regs[MCL_RAMP_STAT] |= stop_l ? MCL_RAMP_EVENT_STOP_L : MCL_RAMP_EVENT_STOP_R;
+	}
+}
+
+void Thorlabs_TMC5130_model::stepPosition(double dt)
+{
+	double target = (double)(int32_t)_regs[MCL_XTARGET];
+	double remaining = target - _position;
+	double speed = fabs(_velocity);
+	int dir = (_velocity > 0) - (_velocity < 0);
+	int want = (remaining > 0) - (remaining < 0);
+
+	double vstart = regVelocity(MCL_VSTART);
+	double v1 = regVelocity(MCL_V1);
+	double vmax = regVelocity(MCL_VMAX);
+	double vstop = regVelocity(MCL_VSTOP);
+	double a1 = regAccel(MCL_A1);
+	double amax = regAccel(MCL_AMAX);
+	double dmax = regAccel(MCL_DMAX);
+	double d1 = regAccel(MCL_D1);
+
+	//V1 = 0 disables the A1/D1 phases
+	bool twoStage = (v1 > 0);
+
+	//Waiting out TZEROWAIT after the last stop
+	if (speed == 0 && _timeNs < _zerowaitUntilNs) {
+		_phase = phaseZeroWait;
+		return;
+	}
+
+	if (speed == 0 && want == 0) {
+		_phase = phaseStopped;
+		return;
+	}
+
+	//Target moved behind us: ramp down to zero, then start a second move
+	if (dir != 0 && dir != want) {
+		bool upper = twoStage && speed > v1;
+		speed -= (upper || !twoStage ? dmax : d1) * dt;
+		_phase = upper || !twoStage ? phaseDMAX : phaseD1;
+		_regs[MCL_RAMP_STAT] |= MCL_RAMP_SECOND_MOVE;
+
+		if (speed <= 0) {
+			speed = 0;
+			_zerowaitUntilNs = _timeNs + (uint64_t)((double)_regs[MCL_TZEROWAIT] * 512 * 1e9 / fclk);
+		}
+		_velocity = dir * speed;
+		move(_velocity * dt);
+		return;
+	}
+
+	//Starting from standstill jumps straight to VSTART
+	if (speed == 0) {
+		speed = vstart;
+	}
+	double entry = speed;
+
+	double distance = fabs(remaining);
+
+	//Look at least one integration step ahead, short steps between datagrams would
+	//otherwise see a shorter horizon. Once braking for a target keep braking, integration
+	//drift must not flip it back to accelerating (the final phase lands exactly anyway).
+	//Only while heading for it: a reversal also ends in DMAX / D1, at standstill.
+	double horizon = (dt > step_ns * 1e-9) ? dt : step_ns * 1e-9;
+	bool braking = dir == want && (_phase == phaseDMAX || _phase == phaseD1) && _brakeTarget == _regs[MCL_XTARGET];
+
+	if (braking || distance <= brakingDistance(speed) + speed * horizon) {
+		_brakeTarget = _regs[MCL_XTARGET];
+		if (twoStage && speed > v1) {
+			//Land on V1 exactly where D1 has to take over, so the slack from starting to
+			//brake up to a step early is taken up here at speed instead of in the D1 tail
+			double lower = distance - brakingDistance(v1);
+			double needed = (lower > 0) ? (speed * speed - v1 * v1) / (2 * lower) : dmax;
+			speed -= needed * dt;
+			if (speed < v1) {
+				speed = v1;
+			}
+			_phase = phaseDMAX;
+		}
+		else {
+			//Final phase: use whatever deceleration lands exactly on VSTOP at the target,
+			//which is D1 (or DMAX) when on schedule
+			double needed = (speed * speed - vstop * vstop) / (2 * distance);
+			speed -= ((needed > 0) ? needed : 0) * dt;
+			_phase = twoStage ? phaseD1 : phaseDMAX;
+		}
+		if (speed < vstop) {
+			speed = vstop;
+		}
+	}
+	else if (speed < vmax) {
+		if (twoStage && speed < v1) {
+			speed += a1 * dt;
+			_phase = phaseA1;
+		}
+		else {
+			speed += amax * dt;
+			_phase = phaseAMAX;
+		}
+		if (speed > vmax) {
+			speed = vmax;
+		}
+	}
+	else if (speed > vmax) {
+		//VMAX lowered during the move
+		speed -= ((twoStage && speed <= v1) ? d1 : dmax) * dt;
+		_phase = (twoStage && speed <= v1) ? phaseD1 : phaseDMAX;
+		if (speed < vmax) {
+			speed = vmax;
+		}
+	}
+	else {
+		_phase = phaseCruise;
+	}
+
+	//Guard against a profile that can never get going (i.e. VSTART and AMAX both 0)
+	if (speed <= 0) {
+		_velocity = 0;
+		_phase = phaseStopped;
+		return;
+	}
+
+	//Cover the step at its mean speed, exact while the rate is constant. Moving at the end
+	//speed instead lags behind the ramp on every decelerating step.
+	double travel = (entry + speed) / 2 * dt;
+
+	//Arrived, stop on the target. A target moved closer than the braking distance
+	//also ends here instead of overshooting and coming back.
+	if (travel >= distance) {
+		move(remaining);
+		_velocity = 0;
+		_regs[MCL_RAMP_STAT] |= MCL_RAMP_EVENT_POS_REACHED;
+		_zerowaitUntilNs = _timeNs + (uint64_t)((double)_regs[MCL_TZEROWAIT] * 512 * 1e9 / fclk);
+		_phase = (_timeNs < _zerowaitUntilNs) ? phaseZeroWait : phaseStopped;
+		return;
+	}
+
+	_velocity = want * speed;
+	move(want * travel);
+}
+
+void Thorlabs_TMC5130_model::stepVelocity(double dt, double target)
+{
+	//Velocity mode uses AMAX both ways
+	double amax = regAccel(MCL_AMAX);
+	double dv = amax * dt;
+	bool speedingUp = fabs(target) > fabs(_velocity) && (target * _velocity >= 0);
+
+	if (_velocity < target) {
+		_velocity = (_velocity + dv > target) ? target : _velocity + dv;
+	}
+	else if (_velocity > target) {
+		_velocity = (_velocity - dv < target) ? target : _velocity - dv;
+	}
+
+	if (_velocity == target) {
+		_phase = (target == 0) ? phaseStopped : phaseCruise;
+	}
+	else {
+		_phase = speedingUp ? phaseAMAX : phaseDMAX;
+	}
+
+	move(_velocity * dt);
+}
+
+void Thorlabs_TMC5130_model::move(double distance)
+{
+	int32_t before = (int32_t)_regs[MCL_XACTUAL];
+
+	_position += distance;
+
+	int32_t after = (int32_t)llround(_position);
+	if (after != before) {
+		_regs[MCL_XACTUAL] = (uint32_t)after;
+
+		//Ideal encoder, one count per microstep
+		_regs[MCL_X_ENC] += (uint32_t)(after - before);
+		_lastStepNs = _timeNs;
+	}
+}
+
+uint32_t Thorlabs_TMC5130_model::peek(uint8_t addr)
+{
+	addr &= ~MCL_WRITE_BIT;
+	if (addr == MCL_VACTUAL || addr == MCL_RAMP_STAT || addr == MCL_DRV_STATUS) {
+		//Live fields, without clearing anything
+		uint32_t value;
+		switch (addr) {
+		case MCL_VACTUAL:
+			value = (uint32_t)vactual() & mask(addr);
+			break;
+		case MCL_RAMP_STAT:
+			value = rampStat();
+			break;
+		default:
+			value = _regs[addr];
+			if (_velocity == 0 && (_timeNs - _lastStepNs) * 1e-9 * fclk >= MCL_SIM_STST_CLOCKS) {
+				value |= MCL_SIM_DRV_STST;
+			}
+			break;
+		}
+		return value;
+	}
+	return _regs[addr];
+}
+
+void Thorlabs_TMC5130_model::poke(uint8_t addr, uint32_t value)
+{
+	_regs[addr & ~MCL_WRITE_BIT] = value;
+}
+
+void Thorlabs_TMC5130_model::setSwitches(bool stop_l, bool stop_r)
+{
+	_stop_l = stop_l;
+	_stop_r = stop_r;
+}
+
+uint8_t Thorlabs_TMC5130_model::spiStatus()
+{
+	uint32_t ramp = rampStat();
+	uint32_t drv = peek(MCL_DRV_STATUS);
+	uint8_t status = 0;
+
+	if (_regs[MCL_GSTAT] & MCL_SIM_GSTAT_RESET) status |= MCL_STATUS_RESET_FLAG;
+	if (_regs[MCL_GSTAT] & MCL_SIM_GSTAT_DRV_ERR) status |= MCL_STATUS_DRIVER_ERROR;
+	if (drv & MCL_SIM_DRV_SG) status |= MCL_STATUS_SG2;
+	if (drv & MCL_SIM_DRV_STST) status |= MCL_STATUS_STANDSTILL;
+	if (ramp & MCL_RAMP_VELOCITY_REACHED) status |= MCL_STATUS_VELOCITY_REACHED;
+	if (ramp & MCL_RAMP_POSITION_REACHED) status |= MCL_STATUS_POSITION_REACHED;
+	if (ramp & MCL_RAMP_STATUS_STOP_L) status |= MCL_STATUS_STOP_L;
+	if (ramp & MCL_RAMP_STATUS_STOP_R) status |= MCL_STATUS_STOP_R;
+
+	return status;
+}
+
+uint32_t Thorlabs_TMC5130_model::rampStat()
+{
+	//Sticky event / second_move bits live in the register, the rest is derived
+	uint32_t status = _regs[MCL_RAMP_STAT] & (MCL_RAMP_EVENTS | MCL_RAMP_SECOND_MOVE);
+	int32_t vmax = _regs[MCL_VMAX];
+	int32_t _vactual = vactual();
+
+	if (_stop_l) status |= MCL_RAMP_STATUS_STOP_L;
+	if (_stop_r) status |= MCL_RAMP_STATUS_STOP_R;
+
+	if (_vactual == 0) {
+		status |= MCL_RAMP_VZERO;
+	}
+	if (_timeNs < _zerowaitUntilNs) {
+		status |= MCL_RAMP_T_ZEROWAIT_ACTIVE;
+	}
+
+	switch (_regs[MCL_RAMPMODE] & 0x3) {
+	case Thorlabs_TMC5130::positionMode:
+		if (_regs[MCL_XACTUAL] == _regs[MCL_XTARGET]) {
+			status |= MCL_RAMP_POSITION_REACHED;
+		}
+		if (_vactual == vmax || _vactual == -vmax) {
+			status |= MCL_RAMP_VELOCITY_REACHED;
+		}
+		break;
+	case Thorlabs_TMC5130::velocityModePos:
+		if (_vactual == vmax) {
+			status |= MCL_RAMP_VELOCITY_REACHED;
+		}
+		break;
+	case Thorlabs_TMC5130::velocityModeNeg:
+		if (_vactual == -vmax) {
+			status |= MCL_RAMP_VELOCITY_REACHED;
+		}
+		break;
+	default:
+		//Hold mode keeps whatever velocity it had
+		status |= MCL_RAMP_VELOCITY_REACHED;
+		break;
+	}
+
+	return status;
+}
+
+uint32_t Thorlabs_TMC5130_model::readRegister(uint8_t addr)
+{
+	uint8_t type = access(addr);
+	uint32_t value;
+
+	//Write-only and unused addresses read back as 0
+	if (!(type & MCL_SIM_R)) {
+		return 0;
+	}
+
+	value = peek(addr);
+
+	if (type & MCL_SIM_RC) {
+		_regs[addr] = 0;
+	}
+	if (addr == MCL_RAMP_STAT) {
+		_regs[MCL_RAMP_STAT] &= ~MCL_RAMP_SECOND_MOVE;
+	}
+
+	return value;
+}
+
+void Thorlabs_TMC5130_model::writeRegister(uint8_t addr, uint32_t data)
+{
+	uint8_t type = access(addr);
+
+	if (!(type & MCL_SIM_W)) {
+		return;
+	}
+
+	if (type & MCL_SIM_WC) {
+		//Only the clearable bits react, and only to 1s
+		_regs[addr] &= ~(data & mask(addr));
+		return;
+	}
+
+	_regs[addr] = data & mask(addr);
+
+	//Host is setting the position counter directly
+	if (addr == MCL_XACTUAL) {
+		_position = (double)(int32_t)_regs[MCL_XACTUAL];
+	}
+}
+
+uint8_t Thorlabs_TMC5130_model::access(uint8_t addr)
+{
+	switch (addr) {
+	case MCL_GSTAT:
+	case MCL_ENC_STATUS:
+		return MCL_SIM_R | MCL_SIM_RC;
+	case MCL_RAMP_STAT:
+		return MCL_SIM_R | MCL_SIM_W | MCL_SIM_WC;
+	case MCL_GCONF:
+	case MCL_RAMPMODE:
+	case MCL_XACTUAL:
+	case MCL_XTARGET:
+	case MCL_SW_MODE:
+	case MCL_ENCMODE:
+	case MCL_X_ENC:
+	case MCL_CHOPCONF:
+		return MCL_SIM_R | MCL_SIM_W;
+	case MCL_IFCNT:
+	case MCL_IOIN:
+	case MCL_TSTEP:
+	case MCL_VACTUAL:
+	case MCL_XLATCH:
+	case MCL_ENC_LATCH:
+	case MCL_MSCNT:
+	case MCL_MSCURACT:
+	case MCL_DRV_STATUS:
+	case MCL_PWM_SCALE:
+	case MCL_LOST_STEPS:
+		return MCL_SIM_R;
+	case MCL_SLAVECONF:
+	case MCL_X_COMPARE:
+	case MCL_IHOLD_IRUN:
+	case MCL_TPOWERDOWN:
+	case MCL_TPWMTHRS:
+	case MCL_TCOOLTHRS:
+	case MCL_THIGH:
+	case MCL_VSTART:
+	case MCL_A1:
+	case MCL_V1:
+	case MCL_AMAX:
+	case MCL_VMAX:
+	case MCL_DMAX:
+	case MCL_D1:
+	case MCL_VSTOP:
+	case MCL_TZEROWAIT:
+	case MCL_VDCMIN:
+	case MCL_ENC_CONST:
+	case MCL_MS_LUT_0:
+	case MCL_MS_LUT_1:
+	case MCL_MS_LUT_2:
+	case MCL_MS_LUT_3:
+	case MCL_MS_LUT_4:
+	case MCL_MS_LUT_5:
+	case MCL_MS_LUT_6:
+	case MCL_MS_LUT_7:
+	case MCL_MS_LUTSEL:
+	case MCL_MS_LUTSTART:
+	case MCL_COOLCONF:
+	case MCL_DCCTRL:
+	case MCL_PWMCONF:
+	case MCL_ENCM_CTRL:
+		return MCL_SIM_W;
+	default:
+		return 0;
+	}
+}
+
+uint32_t Thorlabs_TMC5130_model::mask(uint8_t addr)
+{
+	switch (addr) {
+	case MCL_GCONF:			return 0x0003FFFF;
+	case MCL_GSTAT:			return 0x00000007;
+	case MCL_IFCNT:			return 0x000000FF;
+	case MCL_SLAVECONF:		return 0x00000FFF;
+	case MCL_IHOLD_IRUN:	return 0x000F1F1F;
+	case MCL_TPOWERDOWN:	return 0x000000FF;
+	case MCL_TSTEP:
+	case MCL_TPWMTHRS:
+	case MCL_TCOOLTHRS:
+	case MCL_THIGH:
+	case MCL_V1:
+	case MCL_LOST_STEPS:	return 0x000FFFFF;
+	case MCL_RAMPMODE:		return 0x00000003;
+	case MCL_VACTUAL:		return 0x00FFFFFF;
+	case MCL_VSTART:
+	case MCL_VSTOP:			return 0x0003FFFF;
+	case MCL_A1:
+	case MCL_AMAX:
+	case MCL_DMAX:
+	case MCL_D1:
+	case MCL_TZEROWAIT:		return 0x0000FFFF;
+	case MCL_VMAX:
+	case MCL_VDCMIN:		return 0x007FFFFF;
+	case MCL_SW_MODE:		return 0x00000FFF;
+	case MCL_RAMP_STAT:		return MCL_RAMP_EVENTS;	// Only the event flags can be written
+	case MCL_ENCMODE:		return 0x000007FF;
+	case MCL_ENC_STATUS:	return 0x00000001;
+	case MCL_MS_LUTSTART:	return 0x00FF00FF;
+	case MCL_MSCNT:			return 0x000003FF;
+	case MCL_MSCURACT:		return 0x01FF01FF;
+	case MCL_COOLCONF:		return 0x01FFEF6F;
+	case MCL_DCCTRL:		return 0x00FF03FF;
+	case MCL_PWMCONF:		return 0x003FFFFF;
+	case MCL_PWM_SCALE:		return 0x000000FF;
+	case MCL_ENCM_CTRL:		return 0x00000003;
+	default:				return 0xFFFFFFFF;
+	}
+}
+
+
+//-----------------------------------------------------------------------
+//------------------------------ Bus model ------------------------------
+//-----------------------------------------------------------------------
+
+Thorlabs_TMC5130_simbus::Thorlabs_TMC5130_simbus(uint32_t spi_hz, uint32_t cs_gap_ns, uint32_t transaction_ns)
+{
+	this->spi_hz = spi_hz;
+	this->cs_gap_ns = cs_gap_ns;
+	this->transaction_ns = transaction_ns;
+	_timeNs = 0;
+	_freeNs = 0;
+	resetStats();
+}
+
+void Thorlabs_TMC5130_simbus::datagram(size_t count)
+{
+	uint64_t ns = datagramNs(count);
+
+	_timeNs = freeAt();
+	datagrams++;
+	bytes += count;
+	busy_ns += ns;
+	_timeNs += ns;
+}
+
+void Thorlabs_TMC5130_simbus::transaction()
+{
+	_timeNs = freeAt();
+	transactions++;
+	busy_ns += transaction_ns;
+	_timeNs += transaction_ns;
+}
+
+uint64_t Thorlabs_TMC5130_simbus::background(size_t datagrams, size_t count)
+{
+	uint64_t ns = transaction_ns + datagrams * datagramNs(count);
+
+	_freeNs = freeAt() + ns;
+	transactions++;
+	this->datagrams += datagrams;
+	bytes += datagrams * count;
+	busy_ns += ns;
+	return _freeNs;
+}
+
+void Thorlabs_TMC5130_simbus::resetStats()
+{
+	datagrams = 0;
+	bytes = 0;
+	transactions = 0;
+	busy_ns = 0;
+}
+
+
+//-----------------------------------------------------------------------
+//--------------------------- Simulated driver --------------------------
+//-----------------------------------------------------------------------
+
+Thorlabs_TMC5130_sim::Thorlabs_TMC5130_sim(Thorlabs_TMC5130_simbus* bus)
+{
+	_bus = bus ? bus : &_ownBus;
+	_pending = NULL;
+#ifdef MCL_ENABLE_TIMELINE
+	model.setPhaseCallback(modelPhase, this);
+#endif
+	_pendingDone = 0;
+	resetSimStats();
+}
+
+void Thorlabs_TMC5130_sim::advance(uint64_t ns)
+{
+	_bus->idle(ns);
+	model.advanceTo(_bus->now());
+	poll();
+}
+
+bool Thorlabs_TMC5130_sim::poll()
+{
+	if (!_pending || _bus->now() < _pendingDone) {
+		return false;
+	}
+
+	asyncTransfer* xfer = _pending;
+	_pending = NULL;
+	completeAsync(xfer);
+	return true;
+}
+
+void Thorlabs_TMC5130_sim::resetSimStats()
+{
+	_stats.datagrams = 0;
+	_stats.bytes = 0;
+	_stats.begins = 0;
+	_stats.ends = 0;
+	_stats.transfers = 0;
+	_stats.bus_ns = 0;
+}
+
+void Thorlabs_TMC5130_sim::Thorlabs_SPI_transfer(void *buf, size_t count)
+{
+	uint8_t* cmd = (uint8_t*)buf;
+	uint64_t start = _bus->now();
+
+	_stats.transfers++;
+
+	//The chip latches one datagram per CS frame
+	for (size_t i = 0; i + MCL_DATAGRAM_SIZE <= count; i += MCL_DATAGRAM_SIZE) {
+		_bus->datagram(MCL_DATAGRAM_SIZE);
+		model.advanceTo(_bus->now());
+		model.datagram(&cmd[i]);
+
+		_stats.datagrams++;
+		_stats.bytes += MCL_DATAGRAM_SIZE;
+	}
+
+	_stats.bus_ns += _bus->now() - start;
+}
+
+void Thorlabs_TMC5130_sim::Thorlabs_SPI_begin()
+{
+	uint64_t start = _bus->now();
+
+	_stats.begins++;
+	_bus->transaction();
+	_stats.bus_ns += _bus->now() - start;
+}
+
+void Thorlabs_TMC5130_sim::Thorlabs_SPI_end()
+{
+	_stats.ends++;
+}
+
+#ifdef MCL_ENABLE_TIMELINE
+void Thorlabs_TMC5130_sim::modelPhase(void* context, Thorlabs_TMC5130_model::rampPhase phase, uint64_t time_ns)
+{
+	Thorlabs_TMC5130_sim* sim = (Thorlabs_TMC5130_sim*)context;
+	sim->timelinePhase(MCL_TIMELINE_MODEL,
+		(phase == Thorlabs_TMC5130_model::phaseStopped) ? NULL : Thorlabs_TMC5130_model::phaseName(phase),
+		(uint32_t)time_ns);
+}
+#endif
+
+uint32_t Thorlabs_TMC5130_sim::Thorlabs_get_time_ns()
+{
+	return (uint32_t)_bus->now();
+}
+
+void Thorlabs_TMC5130_sim::Thorlabs_SPI_transfer_async(asyncTransfer* xfer)
+{
+	//Previous transfer must be finished before the bus can take another one.
+	//Its callback may submit the next, so keep going until nothing is pending.
+	while (_pending) {
+		if (_pendingDone > _bus->now()) {
+			advance(_pendingDone - _bus->now());
+		}
+		else {
+			poll();
+		}
+	}
+
+	//The model sees each datagram at the bus time it ends, ahead of the clock
+	uint64_t start = _bus->freeAt();
+	uint64_t time = start + _bus->transaction_ns;
+	for (size_t i = 0; i < xfer->datagrams; i++) {
+		time += _bus->datagramNs(MCL_DATAGRAM_SIZE);
+		model.advanceTo(time);
+		model.datagram(&xfer->buf[i * MCL_DATAGRAM_SIZE]);
+	}
+
+	_pending = xfer;
+	_pendingDone = _bus->background(xfer->datagrams, MCL_DATAGRAM_SIZE);
+
+	_stats.begins++;
+	_stats.ends++;
+	_stats.transfers += xfer->datagrams;
+	_stats.datagrams += xfer->datagrams;
+	_stats.bytes += xfer->datagrams * MCL_DATAGRAM_SIZE;
+	_stats.bus_ns += _pendingDone - start;
+}
@@ -0,0 +1,129 @@
+/*
+ * TMC5130_spidev.cpp
+ *
+ *  Linux spidev transport
+ */
+
+#if defined(__linux__)
+
+#include "TMC5130_spidev.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+Thorlabs_TMC5130_spidev::Thorlabs_TMC5130_spidev(const char* device, uint32_t speed_hz)
+{
+	_device = device;
+	_speed = speed_hz;
+	_fd = -1;
+	_lastError = 0;
+	_ioctls = 0;
+}
+
+Thorlabs_TMC5130_spidev::~Thorlabs_TMC5130_spidev()
+{
+	if (_fd >= 0) {
+		close(_fd);
+	}
+}
+
+void Thorlabs_TMC5130_spidev::Thorlabs_SPI_setup()
+{
+	uint8_t mode = SPI_MODE_3;
+	uint8_t bits = 8;
+
+	if (_fd >= 0) {
+		return;
+	}
+
+	_fd = open(_device, O_RDWR);
+	if (_fd < 0) {
+		_lastError = errno;
+		return;
+	}
+
+	if (spidev_ioctl(SPI_IOC_WR_MODE, &mode) < 0 ||
+		spidev_ioctl(SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+		spidev_ioctl(SPI_IOC_WR_MAX_SPEED_HZ, &_speed) < 0) {
+		_lastError = errno;
+		close(_fd);
+		_fd = -1;
+	}
+}
+
+void Thorlabs_TMC5130_spidev::Thorlabs_SPI_transfer(void *buf, size_t count)
+{
+	struct spi_ioc_transfer xfer;
+
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.tx_buf = (unsigned long)buf;
+	xfer.rx_buf = (unsigned long)buf;
+	xfer.len = count;
+	xfer.speed_hz = _speed;
+	xfer.bits_per_word = 8;
+
+	spidev_message(&xfer, 1);
+}
+
+void Thorlabs_TMC5130_spidev::Thorlabs_SPI_transfer_datagrams(uint8_t *buf, size_t datagrams)
+{
+	struct spi_ioc_transfer xfers[MCL_MAX_BATCH];
+
+	//Callers never hand over more than MCL_MAX_BATCH, but don't overrun if someone does
+	if (datagrams > MCL_MAX_BATCH) {
+		Thorlabs_TMC5130::Thorlabs_SPI_transfer_datagrams(buf, datagrams);
+		return;
+	}
+
+	memset(xfers, 0, sizeof(xfers[0]) * datagrams);
+	for (size_t i = 0; i < datagrams; i++) {
+		xfers[i].tx_buf = (unsigned long)&buf[i * MCL_DATAGRAM_SIZE];
+		xfers[i].rx_buf = (unsigned long)&buf[i * MCL_DATAGRAM_SIZE];
+		xfers[i].len = MCL_DATAGRAM_SIZE;
+		xfers[i].speed_hz = _speed;
+		xfers[i].bits_per_word = 8;
+
+		//Release CS after every datagram but the last, the chip latches each one on the rising edge
+		xfers[i].cs_change = (i < datagrams - 1) ? 1 : 0;
+	}
+
+	spidev_message(xfers, datagrams);
+}
+
+uint32_t Thorlabs_TMC5130_spidev::Thorlabs_get_time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+int Thorlabs_TMC5130_spidev::spidev_message(struct spi_ioc_transfer* xfers, size_t n)
+{
+	int ret = -1;
+
+	if (_fd >= 0) {
+		_ioctls++;
+		ret = spidev_ioctl(_IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0, SPI_MSGSIZE(n)), xfers);
+		if (ret < 0) {
+			_lastError = errno;
+		}
+	}
+
+	//Nothing was received, don't leave the sent bytes to be decoded as a reply (and SPI_STATUS)
+	if (ret < 0) {
+		for (size_t i = 0; i < n; i++) {
+			memset((void*)(uintptr_t)xfers[i].rx_buf, 0, xfers[i].len);
+		}
+	}
+	return ret;
+}
+
+int Thorlabs_TMC5130_spidev::spidev_ioctl(unsigned long request, void* arg)
+{
+	return ioctl(_fd, request, arg);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,77 @@
+/*
+ * TMC5130_stream.cpp
+ *
+ *  Velocity streaming, one transaction per servo tick
+ */
+
+#include "TMC5130_stream.h"
+
+Thorlabs_TMC5130_stream::Thorlabs_TMC5130_stream(Thorlabs_TMC5130* drv, bool readEncoder)
+{
+	_drv = drv;
+	_readEncoder = readEncoder;
+	_known = false;
+	_mode = Thorlabs_TMC5130::velocityModePos;
+	_vmax = 0;
+	_velocity = 0;
+	_position = 0;
+	_encoder = 0;
+	_lastDatagrams = 0;
+}
+
+uint8_t Thorlabs_TMC5130_stream::update(int32_t velocity)
+{
+	uint8_t addrs[4];
+	uint32_t data[4];
+	int32_t out[4];
+	size_t n = 0;
+
+	//Reads first, so the writes clock out the last reply
+	addrs[n] = MCL_XACTUAL;
+	data[n++] = 0;
+	if (_readEncoder) {
+		addrs[n] = MCL_X_ENC;
+		data[n++] = 0;
+	}
+	size_t reads = n;
+
+	//Direction goes in RAMPMODE, VMAX only holds the magnitude. Standing still keeps the direction.
+	uint32_t vmax = (velocity < 0) ? -(int64_t)velocity : velocity;
+	if (vmax > MCL_STREAM_VMAX_LIMIT) {
+		vmax = MCL_STREAM_VMAX_LIMIT;
+	}
+	Thorlabs_TMC5130::rampMode mode = _mode;
+	if (velocity > 0) {
+		mode = Thorlabs_TMC5130::velocityModePos;
+	}
+	else if (velocity < 0) {
+		mode = Thorlabs_TMC5130::velocityModeNeg;
+	}
+
+	if (!_known || vmax != _vmax) {
+		addrs[n] = MCL_VMAX | MCL_WRITE_BIT;
+		data[n++] = vmax;
+	}
+	if (!_known || mode != _mode) {
+		addrs[n] = MCL_RAMPMODE | MCL_WRITE_BIT;
+		data[n++] = mode;
+	}
+
+	uint8_t status = _drv->transfer_registers(addrs, data, n, out);
+
+	_position = out[0];
+	if (_readEncoder) {
+		_encoder = out[1];
+	}
+	_lastDatagrams = (n > reads) ? n : n + 1;
+
+	//A reset chip is back in position mode with VMAX = 0, whatever we think it holds. The flag
+	//stays up until GSTAT is read, so every update rewrites both until then.
+	_known = !(status & MCL_STATUS_RESET_FLAG);
+	_mode = mode;
+	_vmax = vmax;
+	_drv->VMAX = vmax;
+	_velocity = (mode == Thorlabs_TMC5130::velocityModeNeg) ? -(int32_t)vmax : (int32_t)vmax;
+
+	return status;
+}
@@ -0,0 +1,233 @@
+/*
+ * TMC5130_timeline.cpp
+ *
+ *  Timeline recorder with Chrome trace JSON export
+ */
+
+#include "TMC5130_timeline.h"
+#include <cstdio>
+#include <cstring>
+
+static_assert((MCL_TIMELINE_DEPTH & (MCL_TIMELINE_DEPTH - 1)) == 0, "MCL_TIMELINE_DEPTH must be a power of 2");
+
+#define MCL_TIMELINE_MASK       (MCL_TIMELINE_DEPTH - 1)
+
+//Chrome trace process ids, buses are kept clear of driver ids
+#define MCL_TIMELINE_BUS_PID    1000
+
+//Track (thread) ids within a driver process
+static const uint8_t trackTid[4] = {1, 1, 2, 3};
+static const char* const trackName[4] = {"api", "spi", "motion (status)", "motion (model)"};
+
+//Span names are cut to this many characters, so every JSON line fits the dump buffer
+#define MCL_TIMELINE_NAME_MAX   96
+
+//snprintf returns what it would have written. Keep that within the buffer so the
+//writer never reads past it and an appending snprintf never gets a wrapped size.
+static int clampLen(int len, size_t size)
+{
+	if (len < 0) {
+		return 0;
+	}
+	return ((size_t)len >= size) ? (int)(size - 1) : len;
+}
+
+
+Thorlabs_TMC5130_timeline::Thorlabs_TMC5130_timeline()
+{
+	clear();
+}
+
+void Thorlabs_TMC5130_timeline::clear()
+{
+	_head = 0;
+	_tail = 0;
+	_dropped = 0;
+	_timeValid = false;
+	_lastTime = 0;
+	_lastFull = 0;
+	for (size_t d = 0; d < MCL_TIMELINE_DRIVERS; d++) {
+		_phaseName[d][0] = NULL;
+		_phaseName[d][1] = NULL;
+		_phaseStart[d][0] = 0;
+		_phaseStart[d][1] = 0;
+	}
+}
+
+bool Thorlabs_TMC5130_timeline::get(uint32_t i, span* out)
+{
+	if (i >= count()) {
+		return false;
+	}
+	*out = _spans[(_tail + i) & MCL_TIMELINE_MASK];
+	return true;
+}
+
+uint64_t Thorlabs_TMC5130_timeline::unroll(uint32_t time_ns)
+{
+	if (!_timeValid) {
+		_timeValid = true;
+		_lastTime = time_ns;
+		_lastFull = time_ns;
+		return time_ns;
+	}
+
+	//Signed distance from the previous timestamp, so slightly older times (a span
+	//start, another bus running behind) don't look like a wrap
+	int64_t full = _lastFull + (int32_t)(time_ns - _lastTime);
+	if (full > _lastFull) {
+		_lastTime = time_ns;
+		_lastFull = full;
+	}
+	return (full > 0) ? (uint64_t)full : 0;
+}
+
+void Thorlabs_TMC5130_timeline::push(const span& s)
+{
+	//Full, the oldest span makes room
+	if (_head - _tail == MCL_TIMELINE_DEPTH) {
+		_tail++;
+		_dropped++;
+	}
+	_spans[_head++ & MCL_TIMELINE_MASK] = s;
+}
+
+void Thorlabs_TMC5130_timeline::add(uint8_t kind, const char* name, uint8_t driver, uint8_t bus, uint32_t start_ns, uint32_t end_ns, uint8_t datagrams)
+{
+	span s;
+	s.start_ns = unroll(start_ns);
+	s.end_ns = s.start_ns + (uint32_t)(end_ns - start_ns);
+	s.name = name;
+	s.kind = kind;
+	s.driver = driver;
+	s.bus = bus;
+	s.datagrams = datagrams;
+	push(s);
+}
+
+void Thorlabs_TMC5130_timeline::phase(uint8_t kind, const char* name, uint8_t driver, uint32_t time_ns)
+{
+	if (driver >= MCL_TIMELINE_DRIVERS) {
+		return;
+	}
+
+	uint8_t track = (kind == MCL_TIMELINE_MODEL) ? 1 : 0;
+	const char* current = _phaseName[driver][track];
+	if (name == current) {
+		return;
+	}
+
+	uint64_t now = unroll(time_ns);
+	if (current) {
+		span s;
+		s.start_ns = _phaseStart[driver][track];
+		s.end_ns = now;
+		s.name = current;
+		s.kind = kind;
+		s.driver = driver;
+		s.bus = 0;
+		s.datagrams = 0;
+		push(s);
+	}
+
+	_phaseName[driver][track] = name;
+	_phaseStart[driver][track] = now;
+}
+
+void Thorlabs_TMC5130_timeline::closePhases(uint32_t time_ns)
+{
+	for (size_t d = 0; d < MCL_TIMELINE_DRIVERS; d++) {
+		phase(MCL_TIMELINE_STATUS, NULL, d, time_ns);
+		phase(MCL_TIMELINE_MODEL, NULL, d, time_ns);
+	}
+}
+
+bool Thorlabs_TMC5130_timeline::dump(timelineWriter writer, void* context)
+{
+	char line[256];
+	int len;
+	uint32_t drivers[8] = {0};	// Ids seen, one bit each
+	uint32_t buses[8] = {0};
+	uint8_t tracks[256] = {0};	// Kinds seen per driver, one bit each
+
+	static const char header[] = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	if (!writer(header, strlen(header), context)) {
+		return false;
+	}
+
+	bool first = true;
+	for (uint32_t i = 0; i < count(); i++) {
+		const span& s = _spans[(_tail + i) & MCL_TIMELINE_MASK];
+		uint32_t pid;
+
+		if (s.kind == MCL_TIMELINE_SPI) {
+			pid = MCL_TIMELINE_BUS_PID + s.bus;
+			buses[s.bus >> 5] |= 1UL << (s.bus & 31);
+		}
+		else {
+			pid = s.driver;
+			drivers[s.driver >> 5] |= 1UL << (s.driver & 31);
+			tracks[s.driver] |= 1 << s.kind;
+		}
+
+		//Chrome wants microseconds, keep ns resolution with 3 decimals
+		uint64_t dur = s.end_ns - s.start_ns;
+		len = snprintf(line, sizeof(line),
+			"%s{\"name\":\"%.*s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+			first ? "" : ",\n", MCL_TIMELINE_NAME_MAX, s.name ? s.name : "?", pid, trackTid[s.kind & 3],
+			(unsigned long long)(s.start_ns / 1000), (unsigned)(s.start_ns % 1000),
+			(unsigned long long)(dur / 1000), (unsigned)(dur % 1000));
+		len = clampLen(len, sizeof(line));
+		if (s.kind == MCL_TIMELINE_SPI) {
+			len += clampLen(snprintf(line + len, sizeof(line) - len, ",\"args\":{\"driver\":%u,\"datagrams\":%u}}", s.driver, s.datagrams), sizeof(line) - len);
+		}
+		else {
+			len += clampLen(snprintf(line + len, sizeof(line) - len, "}"), sizeof(line) - len);
+		}
+		if (!writer(line, len, context)) {
+			return false;
+		}
+		first = false;
+	}
+
+	//Name the processes and tracks that showed up
+	for (uint32_t id = 0; id < 256; id++) {
+		if (drivers[id >> 5] & (1UL << (id & 31))) {
+			len = snprintf(line, sizeof(line),
+				"%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"driver %u\"}}",
+				first ? "" : ",\n", id, id);
+			len = clampLen(len, sizeof(line));
+			if (!writer(line, len, context)) {
+				return false;
+			}
+			first = false;
+
+			for (uint8_t kind = 0; kind < 4; kind++) {
+				if (!(tracks[id] & (1 << kind))) {
+					continue;
+				}
+				len = snprintf(line, sizeof(line),
+					",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+					id, trackTid[kind], trackName[kind]);
+				len = clampLen(len, sizeof(line));
+				if (!writer(line, len, context)) {
+					return false;
+				}
+			}
+		}
+		if (buses[id >> 5] & (1UL << (id & 31))) {
+			len = snprintf(line, sizeof(line),
+				"%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"bus %u\"}}"
+				",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", MCL_TIMELINE_BUS_PID + id, id,
+				MCL_TIMELINE_BUS_PID + id, trackTid[MCL_TIMELINE_SPI], trackName[MCL_TIMELINE_SPI]);
+			len = clampLen(len, sizeof(line));
+			if (!writer(line, len, context)) {
+				return false;
+			}
+			first = false;
+		}
+	}
+
+	return writer("\n]}\n", 4, context);
+}
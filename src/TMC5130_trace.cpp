@@ -0,0 +1,126 @@
+/*
+ * TMC5130_trace.cpp
+ *
+ *  Ring buffer SPI trace recorder
+ */
+
+#include "TMC5130_trace.h"
+#include "TMC5130_datagram.h"
+
+static_assert((MCL_TRACE_DEPTH & (MCL_TRACE_DEPTH - 1)) == 0, "MCL_TRACE_DEPTH must be a power of 2");
+static_assert(sizeof(Thorlabs_TMC5130_trace::record) == 16, "trace record is expected to be 16 bytes");
+
+#define MCL_TRACE_MASK  (MCL_TRACE_DEPTH - 1)
+
+
+Thorlabs_TMC5130_trace::Thorlabs_TMC5130_trace()
+{
+	_enabled = true;
+	clear();
+}
+
+void Thorlabs_TMC5130_trace::clear()
+{
+	_head = 0;
+	_tail = 0;
+	_dropped = 0;
+}
+
+Thorlabs_TMC5130_trace::record* Thorlabs_TMC5130_trace::claim()
+{
+	//Full, the oldest record makes room
+	if (_head - _tail == MCL_TRACE_DEPTH) {
+		_tail++;
+		_dropped++;
+	}
+	return &_records[_head++ & MCL_TRACE_MASK];
+}
+
+bool Thorlabs_TMC5130_trace::get(uint32_t i, record* out)
+{
+	if (i >= count()) {
+		return false;
+	}
+	*out = _records[(_tail + i) & MCL_TRACE_MASK];
+	return true;
+}
+
+bool Thorlabs_TMC5130_trace::dump(traceWriter writer, void* context)
+{
+	traceHeader header;
+	header.magic = MCL_TRACE_MAGIC;
+	header.version = MCL_TRACE_VERSION;
+	header.record_size = sizeof(record);
+	header.count = count();
+	header.dropped = _dropped;
+
+	if (!writer(&header, sizeof(header), context)) {
+		return false;
+	}
+
+	//At most two contiguous runs: tail to the end of the array, then the wrapped part
+	uint32_t first = _tail & MCL_TRACE_MASK;
+	uint32_t n = header.count;
+	uint32_t run = (first + n > MCL_TRACE_DEPTH) ? (MCL_TRACE_DEPTH - first) : n;
+
+	if (run > 0 && !writer(&_records[first], run * sizeof(record), context)) {
+		return false;
+	}
+	if (n > run && !writer(&_records[0], (n - run) * sizeof(record), context)) {
+		return false;
+	}
+	return true;
+}
+
+uint32_t Thorlabs_TMC5130_trace::submit(const uint8_t* buf, size_t datagrams, uint32_t time_ns, uint8_t id, uint8_t flags)
+{
+	uint32_t slot = _head;
+	if (!_enabled) {
+		return slot;
+	}
+
+	for (size_t i = 0; i < datagrams; i++) {
+		const uint8_t* cmd = &buf[i * MCL_DATAGRAM_SIZE];
+		record* r = claim();
+
+		r->time_ns = time_ns;
+		r->addr = cmd[0];
+		r->status = 0;
+		r->flags = (i == 0) ? (flags | MCL_TRACE_BATCH) : flags;
+		r->id = id;
+		r->tx = Thorlabs_TMC5130_datagram::decode(cmd);
+		r->rx = 0;
+	}
+	return slot;
+}
+
+void Thorlabs_TMC5130_trace::complete(uint32_t slot, const uint8_t* buf, size_t datagrams)
+{
+	if (!_enabled) {
+		return;
+	}
+
+	for (size_t i = 0; i < datagrams; i++) {
+		const uint8_t* reply = &buf[i * MCL_DATAGRAM_SIZE];
+		record* r = &_records[(slot + i) & MCL_TRACE_MASK];
+
+		r->status = Thorlabs_TMC5130_datagram::status(reply);
+		r->rx = Thorlabs_TMC5130_datagram::decode(reply);
+	}
+}
+
+void Thorlabs_TMC5130_trace::log(uint8_t addr, uint32_t tx, const uint8_t* reply, uint32_t time_ns, uint8_t id, uint8_t flags)
+{
+	if (!_enabled) {
+		return;
+	}
+
+	record* r = claim();
+	r->time_ns = time_ns;
+	r->addr = addr;
+	r->status = Thorlabs_TMC5130_datagram::status(reply);
+	r->flags = flags;
+	r->id = id;
+	r->tx = tx;
+	r->rx = Thorlabs_TMC5130_datagram::decode(reply);
+}